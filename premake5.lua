@@ -17,8 +17,16 @@ workspace "bigbong"
         optimize "Full"
         buildoptions { "-Werror", "-Wextra", "-Wall", "-Wpedantic" }
 
+    filter { "options:single-precision" }
+        defines { "OXY_SINGLE_PRECISION" }
+
     filter { }
 
+newoption {
+    trigger = "single-precision",
+    description = "trace rays in float instead of double"
+}
+
 function include_sfml()
     includedirs { "ext/sfml/include" }
     libdirs { "ext/sfml/build/lib" }
@@ -63,3 +71,11 @@ newaction {
         os.execute("(premake5 gmake2 && cd build && make -j config=release) && ./build/bin/release/bigbong")
     end
 }
+
+newaction {
+    trigger = "bench",
+    description = "bench",
+    execute = function()
+        os.execute("(premake5 gmake2 && cd build && make -j config=release) && ./build/bin/release/bigbong --benchmark")
+    end
+}
@@ -164,6 +164,33 @@ namespace Oxy::Application {
 
             ImGui::Spacing();
 
+            ImGui::Text("Sampler");
+
+            if (ImGui::BeginCombo("##0.3", im_render_data.samplers[im_render_data.sampler])) {
+
+                for (int i = 0; i < IM_ARRAYSIZE(im_render_data.samplers); i++) {
+                    auto selected = (i == im_render_data.sampler);
+                    auto label    = im_render_data.samplers[i];
+
+                    if (ImGui::Selectable(label, selected)) {
+                        im_render_data.sampler = i;
+                        selected               = true;
+
+                        ui_event<RenderSamplerChanged>{}(*this, i);
+                    }
+
+                    ImGui::SameLine();
+                    HelpMarker(im_render_data.samplers_help[i]);
+
+                    if (selected)
+                        ImGui::SetItemDefaultFocus();
+                }
+
+                ImGui::EndCombo();
+            }
+
+            ImGui::Spacing();
+
             if (ImGui::InputInt("Max samples", &im_render_data.max_samples, 1, 100)) {
                 if (im_render_data.max_samples < 1) {
                     im_render_data.max_samples = 1;
@@ -292,6 +319,21 @@ namespace Oxy::Application {
 
         // ImGui::Text("Triangle count: %i", m_renderer.scene().triangle_count());
 
+        auto& scene_bvh = m_renderer.scene().bvh_report();
+
+        ImGui::Text("Scene BVH SAH cost: %.3f", scene_bvh.sah_cost);
+        ImGui::Text("Scene BVH nodes: %i, depth %i", (int)scene_bvh.num_nodes,
+                    (int)scene_bvh.max_depth);
+
+        auto tile_stats = m_renderer.tile_stats();
+
+        ImGui::Text("Tile claims: %llu, %.0f ns avg, %llu lost races",
+                    (unsigned long long)tile_stats.claims,
+                    tile_stats.claims != 0 ? (double)tile_stats.claim_ns / tile_stats.claims : 0.0,
+                    (unsigned long long)tile_stats.lost_races);
+        ImGui::Text("Tile steals: %llu, splits: %llu", (unsigned long long)tile_stats.steals,
+                    (unsigned long long)tile_stats.splits);
+
         ImGui::End();
 
         m_preview_layer.draw();
@@ -299,11 +341,9 @@ namespace Oxy::Application {
 
         m_window.display();
 
-        if (!m_renderer.has_block()) {
-            m_renderer.next_sample();
+        if (m_renderer.poll_progress())
             m_renderer.film().copy_to_rgba_buffer(m_preview_layer.get_mutable_buffer(),
                                                   im_render_data.exposure);
-        }
     }
 
     void App::event_loop_handler(sf::Event& evnt) { (void)evnt; }
@@ -18,6 +18,7 @@ namespace Oxy::Application {
         RenderPreviewEnabledToggled,
         RenderPreviewModeChanged,
         RenderAlgorithmChanged,
+        RenderSamplerChanged,
         RenderMaxSamplesChanged,
         RenderContinousSamplingToggled,
 
@@ -56,6 +57,14 @@ namespace Oxy::Application {
                                                "Full pathtracing, global illumination"};
         int         rendering_mode          = 0;
 
+        // in the order of Renderer::SamplerType
+        const char* samplers[3]      = {"Independent", "Sobol", "Blue noise"};
+        const char* samplers_help[3] = {"Uncorrelated random samples, slowest to converge",
+                                        "Owen scrambled Sobol points, stratified per pixel",
+                                        "Sobol points rotated by a blue noise mask, fine grained "
+                                        "noise at low sample counts"};
+        int         sampler          = 1;
+
         bool continous_sampling = true;
         int  max_samples        = 32;
 
@@ -197,6 +206,13 @@ namespace Oxy::Application {
         }
     };
 
+    template <>
+    struct ui_event<RenderSamplerChanged> {
+        void operator()(App& app, int sampler) {
+            app.renderer().set_sampler((Renderer::SamplerType)sampler);
+        }
+    };
+
     template <>
     struct ui_event<RenderMaxSamplesChanged> {
         void operator()(App& app, int num_samples) { app.renderer().set_max_samples(num_samples); }
@@ -252,6 +268,7 @@ namespace Oxy::Application {
             snprintf(app.im_window_data.input_render_height, 16, "%i",
                      app.im_window_data.render_height);
 
+            ui_event<RenderSamplerChanged>{}(app, app.im_render_data.sampler);
             ui_event<RenderMaxSamplesChanged>{}(app, app.im_render_data.max_samples);
             ui_event<RenderContinousSamplingToggled>{}(app, app.im_render_data.continous_sampling);
         }
@@ -1,7 +1,14 @@
 
+#include <string>
+
 #include "app/app.hpp"
 
-int main() {
+#include "renderer/benchmark.hpp"
+
+int main(int argc, char** argv) {
+
+    if (argc > 1 && std::string(argv[1]) == "--benchmark")
+        return Oxy::Renderer::run_benchmarks(argc > 2 ? argv[2] : "./bunny.stl");
 
     Oxy::Application::App app(sf::Vector2u(1600, 900));
     app.run();
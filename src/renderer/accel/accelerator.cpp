@@ -1,34 +1,57 @@
-#include "accelerator.hpp"
+#include "renderer/accel/accelerator.hpp"
 
-/*
+#include "renderer/utils/thread_pool.hpp"
 
 namespace Oxy::Renderer {
 
-    bool Accelerator::intersect_ray(const glm::dvec3& origin, const glm::dvec3& dir,
-                                    IntersectionResult& res) const {
+    void Accelerator::build(const BVHBuildParams& params) {
+        m_params = params;
 
-        IntersectionResult results[2];
+        // the trees are independent, their builds fork onto the same pool
+        TaskGroup tasks;
 
-        m_triangle_bvh.intersect_ray(origin, dir, results[0]);
-        m_sphere_bvh.intersect_ray(origin, dir, results[1]);
+        tasks.run([this] {
+            build_accelerator_tree(m_triangle_tree, m_triangles, m_params, triangle_block_width,
+                                   pack_triangle_blocks<triangle_block_width>);
+        });
 
-        for (int i = 0; i < 2; i++) {
-            if (results[i].hit && results[i].t < res.t)
-                res = results[i];
-        }
+        tasks.run([this] {
+            build_accelerator_tree(m_sphere_tree, m_spheres, m_params, sphere_block_width,
+                                   pack_sphere_blocks<sphere_block_width>);
+        });
 
-        return res.hit;
-    }
+        tasks.wait();
+
+        // bounds over whichever trees are not empty
+        m_bbox = empty_bbox();
+
+        std::vector<BoundingSphere> bspheres;
+
+        auto add_bounds = [&](const auto& tree) {
+            if (tree.empty())
+                return;
 
-    bool Accelerator::intersect_line(const glm::dvec3& start, const glm::dvec3& end,
-                                     IntersectionResult& res) const {
+            m_bbox.first  = glm::min(m_bbox.first, tree.bvh.bbox.first);
+            m_bbox.second = glm::max(m_bbox.second, tree.bvh.bbox.second);
 
-        auto dir = end - start;
-        auto len = glm::length(dir);
-        dir /= len;
+            bspheres.push_back(tree.bvh.bsphere);
+        };
 
-        return intersect_ray(start, dir, res);
+        add_bounds(m_triangle_tree);
+        add_bounds(m_sphere_tree);
+
+        if (bspheres.size() == 1) {
+            m_bsphere = bspheres[0];
+        }
+        else if (bspheres.size() == 2) {
+            auto center = 0.5 * (m_bbox.first + m_bbox.second);
+            auto radius = 0.0;
+
+            for (const auto& [sphere_center, sphere_radius] : bspheres)
+                radius = std::max(radius, glm::distance(center, sphere_center) + sphere_radius);
+
+            m_bsphere = {center, radius};
+        }
     }
 
 } // namespace Oxy::Renderer
-*/
@@ -1,32 +1,199 @@
 #pragma once
 
-/*
-
-#include <numeric>
+#include <algorithm>
+#include <vector>
 
 #include <glm/glm.hpp>
 
 #include "renderer/accel/bvh.hpp"
-#include "renderer/utils/camera.hpp"
-#include "renderer/utils/intersection_result.hpp"
+#include "renderer/accel/bvh_optimize.hpp"
+#include "renderer/accel/compressed_bvh.hpp"
+#include "renderer/accel/primitive.hpp"
+#include "renderer/accel/sphere_block.hpp"
+#include "renderer/accel/triangle_block.hpp"
+#include "renderer/accel/wide_bvh.hpp"
 
 namespace Oxy::Renderer {
 
+    // one tree over the blocks of a single primitive type, in whichever layout was asked for
+    template <typename T, typename Block>
+    struct AcceleratorTree {
+        LinearBVH<T>      bvh; // no nodes with the compressed layout, only the bounds
+        WideBVH<T, 4>     bvh4;
+        WideBVH<T, 8>     bvh8;
+        BVHCostReport     report;
+        BVHOptimizeReport optimize_report; // passes 0 if the build was not optimized
+        size_t            num_primitives = 0;
+
+        CompressedBVH<T, compressed_bvh_width> cbvh;
+
+        std::vector<Block> blocks;
+
+        bool empty() const { return blocks.empty(); }
+
+        size_t memory_usage() const {
+            return blocks.size() * sizeof(Block) + bvh.nodes.size() * sizeof(LinearBVHNode) +
+                   bvh4.nodes.size() * sizeof(WideBVHNode<4>) +
+                   bvh8.nodes.size() * sizeof(WideBVHNode<8>) +
+                   cbvh.nodes.size() * sizeof(CompressedBVHNode<compressed_bvh_width>);
+        }
+
+        template <typename R, typename LeafFn>
+        bool traverse(BVHLayout layout, RayT<R>& ray, LeafFn&& leaf_fn) const {
+            switch (layout) {
+            case BVHLayout::Binary: return linear_bvh_traverse(bvh.nodes, ray, leaf_fn);
+            case BVHLayout::Wide4: return wide_bvh_traverse<4>(bvh4.nodes, ray, leaf_fn);
+            case BVHLayout::Wide8: return wide_bvh_traverse<8>(bvh8.nodes, ray, leaf_fn);
+            case BVHLayout::Compressed: return compressed_bvh_traverse(cbvh, ray, leaf_fn);
+            }
+
+            return false;
+        }
+    };
+
+    // leaves are costed per block, since one kernel call tests a whole block
+    inline BVHBuildParams block_build_params(BVHBuildParams params, int block_width) {
+        params.leaf_block_size = block_width;
+        params.max_leaf_size   = std::max(params.max_leaf_size, params.leaf_block_size);
+
+        if (params.layout == BVHLayout::Compressed)
+            params.max_leaf_size =
+                std::min(params.max_leaf_size, compressed_bvh_max_leaf_blocks * block_width);
+
+        return params;
+    }
+
+    // builds one tree, repacks its leaves into blocks and drops the source primitives
+    template <typename T, typename Block, typename PackFn>
+    void build_accelerator_tree(AcceleratorTree<T, Block>& tree, std::vector<T>& primitives,
+                                const BVHBuildParams& params, int block_width, PackFn&& pack) {
+        tree = {};
+
+        if (primitives.empty())
+            return;
+
+        auto block_params = block_build_params(params, block_width);
+
+        // counted before the build, spatial splits reference some primitives twice
+        tree.num_primitives = primitives.size();
+
+        tree.bvh = build_bvh_generic<T>(primitives, 0, primitives.size(), block_params);
+
+        // only moves inner nodes around, the leaves keep their primitive ranges
+        if (block_params.optimize_passes > 0)
+            tree.optimize_report = optimize_bvh(tree.bvh.nodes, block_params);
+
+        // repoints the leaves at their blocks, so this has to happen before collapsing
+        tree.blocks = pack(tree.bvh.nodes, primitives);
+
+        if (block_params.layout == BVHLayout::Wide4)
+            tree.bvh4 = collapse_bvh<4>(tree.bvh);
+
+        if (block_params.layout == BVHLayout::Wide8)
+            tree.bvh8 = collapse_bvh<8>(tree.bvh);
+
+        tree.report = compute_bvh_cost(tree.bvh, block_params);
+
+        // reorders the blocks, the binary nodes no longer match them and only the bounds stay
+        if (block_params.layout == BVHLayout::Compressed) {
+            tree.cbvh = compress_bvh<compressed_bvh_width>(tree.bvh, tree.blocks, block_width);
+            std::vector<LinearBVHNode>().swap(tree.bvh.nodes);
+        }
+
+        std::vector<T>().swap(primitives);
+    }
+
+    // which primitive a closest hit query ended on, the block and lane index the blocks of
+    // that type
+    struct AcceleratorHit {
+        Primitives       type = Primitives::Triangle;
+        TriangleBlockHit block;
+
+        bool hit() const { return block.hit(); }
+    };
+
+    // triangles and analytic spheres, each type with its own tree over its own simd blocks.
+    // a query walks the triangle tree first and the sphere tree only has to beat that hit,
+    // an empty tree costs nothing so pure meshes and pure point clouds pay for one tree
     class Accelerator final {
     public:
-        bool intersect_ray(const glm::dvec3& origin, const glm::dvec3& dir,
-                           IntersectionResult& res) const;
+        void add_triangles(const std::vector<Triangle>& triangles) {
+            m_triangles.insert(m_triangles.end(), triangles.begin(), triangles.end());
+        }
+
+        void add_spheres(const std::vector<Sphere>& spheres) {
+            m_spheres.insert(m_spheres.end(), spheres.begin(), spheres.end());
+        }
+
+        // builds both trees and releases the primitives, only the blocks are kept
+        void build(const BVHBuildParams& params);
+
+        bool empty() const { return m_triangle_tree.empty() && m_sphere_tree.empty(); }
+
+        template <typename R>
+        bool closest_hit(RayT<R>& ray, AcceleratorHit& hit) const {
+            auto layout = m_params.layout;
+
+            TriangleBlockHit triangle_hit, sphere_hit;
+
+            m_triangle_tree.traverse(
+                layout, ray, closest_hit_leaf_blocks(m_triangle_tree.blocks, ray, triangle_hit));
+
+            m_sphere_tree.traverse(layout, ray,
+                                   closest_hit_leaf_spheres(m_sphere_tree.blocks, ray, sphere_hit));
+
+            if (sphere_hit.hit())
+                hit = {Primitives::Sphere, sphere_hit};
+            else if (triangle_hit.hit())
+                hit = {Primitives::Triangle, triangle_hit};
 
-        bool intersect_line(const glm::dvec3& start, const glm::dvec3& end,
-                            IntersectionResult& res) const;
+            return hit.hit();
+        }
 
-        auto& triangle_bvh() { return m_triangle_bvh; }
-        auto& sphere_bvh() { return m_sphere_bvh; }
+        template <typename R>
+        bool any_hit(RayT<R> ray) const {
+            auto layout = m_params.layout;
+
+            return m_triangle_tree.traverse(layout, ray,
+                                            any_hit_leaf_blocks(m_triangle_tree.blocks, ray)) ||
+                   m_sphere_tree.traverse(layout, ray,
+                                          any_hit_leaf_spheres(m_sphere_tree.blocks, ray));
+        }
+
+        // hitpos in the space of the primitives, spheres need it for their normal
+        glm::dvec3 hit_normal(const AcceleratorHit& hit, const glm::dvec3& hitpos) const {
+            const auto& block = hit.block;
+
+            if (hit.type == Primitives::Sphere)
+                return m_sphere_tree.blocks[block.block].normal(block.lane, hitpos);
+
+            return m_triangle_tree.blocks[block.block].normal(block.lane);
+        }
+
+        const auto& bbox() const { return m_bbox; }
+        const auto& bsphere() const { return m_bsphere; }
+
+        auto num_triangles() const { return m_triangle_tree.num_primitives; }
+        auto num_spheres() const { return m_sphere_tree.num_primitives; }
+
+        const auto& triangle_report() const { return m_triangle_tree.report; }
+        const auto& sphere_report() const { return m_sphere_tree.report; }
+
+        size_t memory_usage() const {
+            return m_triangle_tree.memory_usage() + m_sphere_tree.memory_usage();
+        }
 
     private:
-        BVH<Primitives::Triangle> m_triangle_bvh;
-        BVH<Primitives::Sphere>   m_sphere_bvh;
+        BVHBuildParams m_params;
+
+        BoundingBox    m_bbox = empty_bbox();
+        BoundingSphere m_bsphere;
+
+        std::vector<Triangle> m_triangles; // build input, released by build
+        std::vector<Sphere>   m_spheres;
+
+        AcceleratorTree<Triangle, TriangleBlock<triangle_block_width>> m_triangle_tree;
+        AcceleratorTree<Sphere, SphereBlock<sphere_block_width>>       m_sphere_tree;
     };
 
 } // namespace Oxy::Renderer
-*/
@@ -1,3 +1,208 @@
 #include "renderer/accel/bvh.hpp"
 
-namespace Oxy::Renderer {} // namespace Oxy::Renderer
+#include <array>
+
+namespace Oxy::Renderer {
+
+    // spreads the low 21 bits of v so there are two zero bits between each of them
+    static uint64_t expand_morton_bits(uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffff;
+        v = (v | v << 16) & 0x1f0000ff0000ff;
+        v = (v | v << 8) & 0x100f00f00f00f00f;
+        v = (v | v << 4) & 0x10c30c30c30c30c3;
+        v = (v | v << 2) & 0x1249249249249249;
+        return v;
+    }
+
+    // stable lsd radix sort of (code, index) pairs, 8 bits per pass. every pass counts the
+    // digits of each chunk, then scatters the chunks in parallel to their own slots
+    static void radix_sort_morton(std::vector<uint64_t>& codes, std::vector<uint32_t>& indices,
+                                  int code_bits, bool parallel) {
+        const auto count      = codes.size();
+        const auto grain      = parallel ? bvh_build_grain : count;
+        const auto num_chunks = (count + grain - 1) / grain;
+
+        std::vector<uint64_t> codes_tmp(count);
+        std::vector<uint32_t> indices_tmp(count);
+
+        std::vector<std::array<size_t, 256>> offsets(num_chunks);
+
+        for (int shift = 0; shift < code_bits; shift += 8) {
+            parallel_for(0, count, grain, [&](size_t first, size_t last) {
+                auto& histogram = offsets[first / grain];
+                histogram.fill(0);
+
+                for (auto i = first; i < last; i++)
+                    histogram[(codes[i] >> shift) & 0xff]++;
+            });
+
+            // digit major, chunk minor, so equal digits keep their order across chunks
+            size_t sum = 0;
+
+            for (int digit = 0; digit < 256; digit++) {
+                for (auto& histogram : offsets) {
+                    auto digit_count = histogram[digit];
+                    histogram[digit] = sum;
+                    sum += digit_count;
+                }
+            }
+
+            parallel_for(0, count, grain, [&](size_t first, size_t last) {
+                auto& histogram = offsets[first / grain];
+
+                for (auto i = first; i < last; i++) {
+                    auto slot = histogram[(codes[i] >> shift) & 0xff]++;
+
+                    codes_tmp[slot]   = codes[i];
+                    indices_tmp[slot] = indices[i];
+                }
+            });
+
+            std::swap(codes, codes_tmp);
+            std::swap(indices, indices_tmp);
+        }
+    }
+
+    struct LBVHBuild {
+        const std::vector<BVHBuildPrimitive>& build_prims;
+        const BVHBuildParams&                 params;
+
+        std::vector<uint64_t> codes; // sorted, codes[i] belongs to build_prims[first + i]
+        size_t                first;
+        size_t                leaf_size;
+
+        uint64_t code(size_t i) const { return codes[i - first]; }
+    };
+
+    static BoundingBox emit_lbvh_node(const LBVHBuild& build, size_t left_index,
+                                      size_t right_index, std::vector<LinearBVHNode>& nodes,
+                                      int depth = 0) {
+
+        auto node_index = (uint32_t)nodes.size();
+        nodes.emplace_back();
+
+        const auto count = right_index - left_index;
+
+        if (count <= build.leaf_size) {
+            auto bbox = empty_bbox();
+
+            for (auto i = left_index; i < right_index; i++)
+                grow_bbox(bbox, build.build_prims[i].bbox);
+
+            nodes[node_index].set_bbox(bbox);
+            nodes[node_index].primitives_offset = (uint32_t)left_index;
+            nodes[node_index].num_primitives    = (uint16_t)count;
+
+            return bbox;
+        }
+
+        // the codes in the range share every bit above the highest differing one, so the
+        // first code with that bit set starts the second child. identical codes split by
+        // count, and so does everything past bvh_median_split_depth to bound the depth
+        auto middle = (left_index + right_index) / 2;
+        auto diff   = build.code(left_index) ^ build.code(right_index - 1);
+
+        if (diff != 0 && depth < bvh_median_split_depth) {
+            auto bit = 63 - __builtin_clzll(diff);
+
+            auto first = build.codes.begin() + (left_index - build.first);
+            auto last  = build.codes.begin() + (right_index - build.first);
+
+            auto split_it = std::partition_point(
+                first, last, [&](uint64_t code) { return ((code >> bit) & 1) == 0; });
+
+            middle = left_index + (split_it - first);
+
+            // bits are interleaved x, y, z from the top, x being the highest of each triple
+            nodes[node_index].axis = 2 - bit % 3;
+        }
+
+        BoundingBox left_bbox, right_bbox;
+
+        if (count <= build.params.parallel_threshold) {
+            left_bbox = emit_lbvh_node(build, left_index, middle, nodes, depth + 1);
+
+            nodes[node_index].second_child_offset = (uint32_t)nodes.size();
+
+            right_bbox = emit_lbvh_node(build, middle, right_index, nodes, depth + 1);
+        }
+        else {
+            std::vector<LinearBVHNode> second_nodes;
+            second_nodes.reserve(2 * (right_index - middle));
+
+            TaskGroup tasks;
+            tasks.run([&] {
+                right_bbox = emit_lbvh_node(build, middle, right_index, second_nodes, depth + 1);
+            });
+
+            left_bbox = emit_lbvh_node(build, left_index, middle, nodes, depth + 1);
+
+            tasks.wait();
+
+            nodes[node_index].second_child_offset = append_bvh_subtree(nodes, second_nodes);
+        }
+
+        grow_bbox(left_bbox, right_bbox);
+        nodes[node_index].set_bbox(left_bbox);
+
+        return left_bbox;
+    }
+
+    void build_bvh_lbvh(std::vector<BVHBuildPrimitive>& build_prims, size_t left_index,
+                        size_t right_index, const BVHBuildParams& params,
+                        std::vector<LinearBVHNode>& nodes) {
+
+        const auto count    = right_index - left_index;
+        const bool parallel = count > params.parallel_threshold;
+        const auto grain    = parallel ? bvh_build_grain : count;
+
+        // 10 bits per axis fit 30 bit codes and need half the sort passes, big inputs get
+        // 21 bits per axis so fewer primitives end up sharing a code
+        const int bits_per_axis = count > (1 << 20) ? 21 : 10;
+
+        auto centroid_bbox =
+            bvh_range_bounds(build_prims, left_index, right_index, parallel).second;
+
+        glm::dvec3 scale(0.0);
+
+        for (int axis = 0; axis < 3; axis++) {
+            auto extent = centroid_bbox.second[axis] - centroid_bbox.first[axis];
+            scale[axis] = extent > 0.0 ? ((1 << bits_per_axis) - 1) / extent : 0.0;
+        }
+
+        std::vector<uint64_t> codes(count);
+        std::vector<uint32_t> indices(count);
+
+        parallel_for(left_index, right_index, grain, [&](size_t first, size_t last) {
+            for (auto i = first; i < last; i++) {
+                auto cell = (build_prims[i].centroid - centroid_bbox.first) * scale;
+
+                codes[i - left_index] = expand_morton_bits((uint64_t)cell.x) << 2 |
+                                        expand_morton_bits((uint64_t)cell.y) << 1 |
+                                        expand_morton_bits((uint64_t)cell.z);
+
+                indices[i - left_index] = (uint32_t)(i - left_index);
+            }
+        });
+
+        radix_sort_morton(codes, indices, 3 * bits_per_axis, parallel);
+
+        std::vector<BVHBuildPrimitive> unsorted(build_prims.begin() + left_index,
+                                                build_prims.begin() + right_index);
+
+        parallel_for(left_index, right_index, grain, [&](size_t first, size_t last) {
+            for (auto i = first; i < last; i++)
+                build_prims[i] = unsorted[indices[i - left_index]];
+        });
+
+        // leaves hold one block of primitives, there is no cost model to merge them further
+        auto leaf_size = std::min(params.leaf_block_size, params.max_leaf_size);
+
+        LBVHBuild build{build_prims, params, std::move(codes), left_index,
+                        std::max<size_t>(leaf_size, 1)};
+
+        emit_lbvh_node(build, left_index, right_index, nodes);
+    }
+
+} // namespace Oxy::Renderer
@@ -1,56 +1,70 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <immintrin.h>
 #include <iostream>
+#include <limits>
 #include <numeric>
+#include <tuple>
 #include <vector>
 
 #include <glm/glm.hpp>
 
 #include "renderer/accel/primitive.hpp"
+#include "renderer/utils/ray.hpp"
+#include "renderer/utils/real.hpp"
+#include "renderer/utils/thread_pool.hpp"
 
 namespace Oxy::Renderer {
 
-    inline bool ray_vs_aabb(const glm::dvec3& orig, const glm::dvec3& dir, const glm::dvec3& vmin,
-                            const glm::dvec3& vmax, double& t) {
+    // grows the far distance of box tests by 2 * gamma(3) so rounding never misses a box. with
+    // float rays this is what keeps the traversal watertight, the node bounds are already
+    // rounded outwards
+    template <typename R>
+    constexpr R ray_box_epsilon = R(1) + 2 * rounding_gamma<R>(3);
 
-        auto rdx = 1.0 / dir.x;
-        auto rdy = 1.0 / dir.y;
-        auto rdz = 1.0 / dir.z;
+    // slab test against the rays [tmin, tmax] interval, t is the entry distance
+    template <typename R>
+    inline bool ray_vs_aabb(const RayT<R>& ray, const Vec3<R>& vmin, const Vec3<R>& vmax, R& t) {
+        const Vec3<R>* bounds[2] = {&vmin, &vmax};
 
-        auto t1 = (vmin.x - orig.x) * rdx;
-        auto t2 = (vmax.x - orig.x) * rdx;
-        auto t3 = (vmin.y - orig.y) * rdy;
-        auto t4 = (vmax.y - orig.y) * rdy;
-        auto t5 = (vmin.z - orig.z) * rdz;
-        auto t6 = (vmax.z - orig.z) * rdz;
+        auto t_near = ray.tmin;
+        auto t_far  = ray.tmax;
 
-        auto t7 = std::max(std::min(t1, t2), std::max(std::min(t3, t4), std::min(t5, t6)));
-        auto t8 = std::min(std::max(t1, t2), std::min(std::max(t3, t4), std::max(t5, t6)));
+        for (int axis = 0; axis < 3; axis++) {
+            auto t0 = ((*bounds[ray.sign[axis]])[axis] - ray.origin[axis]) * ray.inv_dir[axis];
+            auto t1 = ((*bounds[1 - ray.sign[axis]])[axis] - ray.origin[axis]) * ray.inv_dir[axis];
 
-        if (t8 < 0.0 || t8 < t7)
+            // written so a nan slab (origin on the plane, zero direction) is ignored
+            t_near = t0 > t_near ? t0 : t_near;
+            t_far  = t1 < t_far ? t1 : t_far;
+        }
+
+        if (t_near > t_far * ray_box_epsilon<R>)
             return false;
 
-        t = t7;
+        t = t_near;
 
         return true;
     }
 
-    inline bool ray_vs_sphere(const glm::dvec3& orig, const glm::dvec3& dir,
-                              const glm::dvec3& center, double radius, double& t) {
+    template <typename R>
+    inline bool ray_vs_sphere(const Vec3<R>& orig, const Vec3<R>& dir, const Vec3<R>& center,
+                              R radius, R& t) {
 
         auto oc   = orig - center;
         auto a    = glm::dot(dir, dir);
-        auto b    = 2.0 * glm::dot(oc, dir);
+        auto b    = R(2) * glm::dot(oc, dir);
         auto c    = glm::dot(oc, oc) - radius * radius;
         auto disc = b * b - 4 * a * c;
 
         if (disc < 0)
             return false;
 
-        auto t1 = (-b + std::sqrt(disc)) / (2.0 * a);
-        auto t2 = (-b - std::sqrt(disc)) / (2.0 * a);
+        auto t1 = (-b + std::sqrt(disc)) / (R(2) * a);
+        auto t2 = (-b - std::sqrt(disc)) / (R(2) * a);
 
         if (t1 < 0) // inside the sphere, return the far point
             t = t2;
@@ -60,31 +74,172 @@ namespace Oxy::Renderer {
         return true;
     }
 
-    template <typename T>
-    struct UnoptimizedBVHNode {
-        UnoptimizedBVHNode(std::vector<T>& prims)
-            : primitives(prims) {}
+    enum class BVHLayout {
+        Binary,
+        Wide4, // 4 children per node, boxes tested with sse
+        Wide8, // 8 children per node, boxes tested with avx
 
-        std::vector<T>& primitives;
+        // 8 children per node with bounds quantized to 8 bits, a third of the size of Wide8
+        // for a few more instructions per node. only pays off for big meshes, trees over
+        // objects and instances use Wide8 instead
+        Compressed,
+    };
 
-        size_t left_index;
-        size_t right_index;
+    enum class BVHBuildMethod {
+        SAH,  // binned surface area heuristic, best trees
+        LBVH, // sorted morton codes, much faster builds for geometry that changes every frame
 
-        BoundingSphere bsphere;
-        BoundingBox    bbox;
+        // sah with spatial splits, primitives straddling a split plane are referenced from
+        // both sides. cuts the box overlap of long thin triangles at the cost of duplicated
+        // references, only for trees that own their primitives
+        SBVH,
+    };
+
+    struct BVHBuildParams {
+        int    num_bins          = 16;  // number of centroid bins per axis
+        double traversal_cost    = 1.0; // relative cost of stepping through an inner node
+        double intersection_cost = 1.0; // relative cost of one primitive test in a leaf
+        size_t max_leaf_size     = 8;
+        size_t leaf_block_size   = 1; // primitives tested together by one leaf kernel call
+
+        // subtrees with more primitives than this are built as tasks on the thread pool,
+        // set to SIZE_MAX to build on the calling thread only
+        size_t parallel_threshold = 4096;
+
+        // refitted trees are rebuilt once their sah cost grows past this multiple of the
+        // cost they were built with, 0 never rebuilds
+        double refit_rebuild_ratio = 1.5;
+
+        // sbvh only: spatial splits are tried where the children of the best object split
+        // overlap by more than this fraction of the root area, and may add at most this
+        // fraction of the primitive count as duplicated references
+        double spatial_split_alpha  = 1e-5;
+        double spatial_split_budget = 0.3;
+
+        // meshes only: passes of treelet restructuring over the finished tree, after which its
+        // nodes are laid out for locality. slow, meant for trees that end up in the mesh cache.
+        // 0 skips the stage
+        int optimize_passes = 0;
+
+        BVHBuildMethod method = BVHBuildMethod::SAH;
+        BVHLayout      layout = BVHLayout::Binary; // node layout used for traversal
+    };
+
+    // no build nests deeper than this, so every traversal stack is a small fixed array. the
+    // sah and morton splits are used down to bvh_median_split_depth, below it ranges are
+    // split at their median which reaches the leaves within 32 more levels for any 32 bit
+    // primitive count
+    constexpr int bvh_median_split_depth = 32;
+    constexpr int bvh_max_depth          = 64;
+
+    // entries a depth first walk of a tree with the given arity needs at most, every level
+    // defers all but one of its children
+    constexpr int bvh_stack_size(int arity) {
+        return (arity - 1) * bvh_max_depth + 1;
+    }
+
+    struct BVHCostReport {
+        double sah_cost             = 0.0; // expected cost per ray that hits the root
+        double expected_node_visits = 0.0;
+        double expected_prim_tests  = 0.0; // counted in leaf kernel calls, see leaf_block_size
+
+        size_t num_nodes     = 0;
+        size_t num_leaves    = 0;
+        size_t max_depth     = 0;
+        double avg_leaf_size = 0.0;
+    };
 
-        UnoptimizedBVHNode<T>* left_node  = nullptr;
-        UnoptimizedBVHNode<T>* right_node = nullptr;
+    inline std::ostream& operator<<(std::ostream& os, const BVHCostReport& report) {
+        return os << "sah cost " << report.sah_cost << " (" << report.expected_node_visits
+                  << " node visits, " << report.expected_prim_tests << " prim tests per ray), "
+                  << report.num_nodes << " nodes, " << report.num_leaves << " leaves, depth "
+                  << report.max_depth << ", " << report.avg_leaf_size << " prims per leaf";
+    }
+
+    inline BoundingBox empty_bbox() {
+        return {glm::dvec3(std::numeric_limits<double>::max()),
+                glm::dvec3(std::numeric_limits<double>::lowest())};
+    }
+
+    inline void grow_bbox(BoundingBox& bbox, const glm::dvec3& point) {
+        bbox.first  = glm::min(bbox.first, point);
+        bbox.second = glm::max(bbox.second, point);
+    }
+
+    inline void grow_bbox(BoundingBox& bbox, const BoundingBox& other) {
+        bbox.first  = glm::min(bbox.first, other.first);
+        bbox.second = glm::max(bbox.second, other.second);
+    }
 
-        ~UnoptimizedBVHNode() {
-            if (left_node != nullptr)
-                delete left_node;
+    inline double surface_area(const BoundingBox& bbox) {
+        auto extent = bbox.second - bbox.first;
 
-            if (right_node != nullptr)
-                delete right_node;
+        if (extent.x < 0.0 || extent.y < 0.0 || extent.z < 0.0)
+            return 0.0;
+
+        return 2.0 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    // number of leaf kernel calls needed for count primitives, a partially filled block costs
+    // as much as a full one
+    inline double bvh_leaf_tests(size_t count, const BVHBuildParams& params) {
+        auto block = std::max<size_t>(params.leaf_block_size, 1);
+        return (double)((count + block - 1) / block);
+    }
+
+    // float bounds are rounded outwards so the node boxes never shrink below the exact ones
+    inline float round_down(double value) {
+        auto f = (float)value;
+        return (double)f > value ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    inline float round_up(double value) {
+        auto f = (float)value;
+        return (double)f < value ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    // 32 byte node, stored in depth first order. the first child of an inner node is the
+    // node directly after it, so only the offset of the second child is stored. it is the
+    // lower one along the split axis unless upper_first is set
+    struct alignas(32) LinearBVHNode {
+        glm::vec3 bbox_min;
+        union {
+            uint32_t primitives_offset;   // leaf
+            uint32_t second_child_offset; // inner node
+        };
+        glm::vec3 bbox_max;
+        uint16_t  num_primitives; // 0 for inner nodes
+        uint8_t   axis;           // split axis of inner nodes
+        uint8_t   upper_first;    // 1 if the first child is the upper one along axis
+
+        bool is_leaf() const { return num_primitives != 0; }
+
+        BoundingBox bbox() const { return {glm::dvec3(bbox_min), glm::dvec3(bbox_max)}; }
+
+        void set_bbox(const BoundingBox& bbox) {
+            for (int axis = 0; axis < 3; axis++) {
+                bbox_min[axis] = round_down(bbox.first[axis]);
+                bbox_max[axis] = round_up(bbox.second[axis]);
+            }
         }
     };
 
+    static_assert(sizeof(LinearBVHNode) == 32);
+
+    // leaves count their primitives in 16 bits, builds clamp max_leaf_size to this
+    constexpr size_t bvh_max_leaf_size = std::numeric_limits<uint16_t>::max();
+
+    template <typename T>
+    struct LinearBVH {
+        std::vector<LinearBVHNode> nodes;
+
+        // exact bounds of the whole tree, the root node only has the float rounded ones
+        BoundingBox    bbox = empty_bbox();
+        BoundingSphere bsphere;
+
+        bool empty() const { return nodes.empty(); }
+    };
+
     template <typename T>
     BoundingBox get_bbox(const std::vector<T>& primitives, size_t start, size_t end) {
         glm::dvec3 min(std::numeric_limits<double>::max());
@@ -107,128 +262,619 @@ namespace Oxy::Renderer {
         glm::dvec3 middle(0.0);
 
         for (auto it = primitives.begin() + start; it != primitives.begin() + end; it++)
-            middle += it->midpoint();
+            middle += PrimitiveTraits::midpoint(*it);
 
         middle /= (double)(end - start);
 
         double radius = 0;
 
         for (auto it = primitives.begin() + start; it != primitives.begin() + end; it++)
-            radius = std::max(radius, glm::distance(middle, it->midpoint()) + it->bsphere().second);
+            radius = std::max(radius, glm::distance(middle, PrimitiveTraits::midpoint(*it)) +
+                                          PrimitiveTraits::bsphere(*it).second);
 
         return {middle, radius};
     }
 
-    template <typename T>
-    UnoptimizedBVHNode<T>* build_bvh_generic(std::vector<T>& primitives, size_t left_index,
-                                             size_t right_index) {
+    // bounds and centroid of every primitive, computed once before the build so the
+    // (possibly virtual) trait calls stay out of the binning loops
+    struct BVHBuildPrimitive {
+        BoundingBox bbox;
+        glm::dvec3  centroid;
+        size_t      index;
+    };
+
+    struct BVHBin {
+        BoundingBox bbox  = empty_bbox();
+        size_t      count = 0;
+    };
+
+    // big ranges are split into chunks of this many primitives when reducing bounds and bins
+    constexpr size_t bvh_build_grain = 1 << 16;
+
+    // reduces [left_index, right_index) with chunk_fn(result, first, last), chunks run on the
+    // thread pool when parallel is set and their results are combined with merge_fn
+    template <typename Result, typename ChunkFn, typename MergeFn>
+    Result bvh_parallel_reduce(size_t left_index, size_t right_index, bool parallel, Result init,
+                               ChunkFn&& chunk_fn, MergeFn&& merge_fn) {
+
+        if (!parallel || right_index - left_index <= bvh_build_grain) {
+            chunk_fn(init, left_index, right_index);
+            return init;
+        }
+
+        auto num_chunks = (right_index - left_index + bvh_build_grain - 1) / bvh_build_grain;
+
+        std::vector<Result> partial(num_chunks, init);
+
+        parallel_for(left_index, right_index, bvh_build_grain, [&](size_t first, size_t last) {
+            chunk_fn(partial[(first - left_index) / bvh_build_grain], first, last);
+        });
 
-        auto* node = new UnoptimizedBVHNode<T>{primitives};
+        for (const auto& result : partial)
+            merge_fn(init, result);
 
-        node->left_index  = left_index;
-        node->right_index = right_index;
+        return init;
+    }
+
+    // node bounds and centroid bounds of a range
+    inline std::pair<BoundingBox, BoundingBox>
+    bvh_range_bounds(const std::vector<BVHBuildPrimitive>& build_prims, size_t left_index,
+                     size_t right_index, bool parallel) {
+
+        using Bounds = std::pair<BoundingBox, BoundingBox>;
+
+        return bvh_parallel_reduce(
+            left_index, right_index, parallel, Bounds{empty_bbox(), empty_bbox()},
+            [&](Bounds& bounds, size_t first, size_t last) {
+                for (auto i = first; i < last; i++) {
+                    grow_bbox(bounds.first, build_prims[i].bbox);
+                    grow_bbox(bounds.second, build_prims[i].centroid);
+                }
+            },
+            [](Bounds& bounds, const Bounds& other) {
+                grow_bbox(bounds.first, other.first);
+                grow_bbox(bounds.second, other.second);
+            });
+    }
+
+    // appends a subtree that was built into its own node vector, rebasing its inner node
+    // offsets, and returns the index of its root
+    inline uint32_t append_bvh_subtree(std::vector<LinearBVHNode>&       nodes,
+                                       const std::vector<LinearBVHNode>& subtree) {
+        auto base = (uint32_t)nodes.size();
+
+        nodes.insert(nodes.end(), subtree.begin(), subtree.end());
+
+        for (auto it = nodes.begin() + base; it != nodes.end(); it++)
+            if (!it->is_leaf())
+                it->second_child_offset += base;
+
+        return base;
+    }
+
+    // best binned sah split of a range by centroid, axis is -1 if no plane separates the
+    // centroids
+    struct BVHObjectSplit {
+        double cost     = std::numeric_limits<double>::max();
+        int    axis     = -1;
+        int    split    = -1; // last bin of the left child
+        int    num_bins = 0;
+
+        glm::dvec3  scale{0.0}; // bins per unit of centroid extent
+        BoundingBox left_bbox  = empty_bbox();
+        BoundingBox right_bbox = empty_bbox();
+    };
 
-        auto [min_bbox, max_bbox] = get_bbox<T>(primitives, left_index, right_index);
+    inline BVHObjectSplit bvh_find_object_split(const std::vector<BVHBuildPrimitive>& build_prims,
+                                                size_t left_index, size_t right_index,
+                                                const BoundingBox&    node_bbox,
+                                                const BoundingBox&    centroid_bbox,
+                                                const BVHBuildParams& params, bool parallel) {
+        BVHObjectSplit best;
 
-        node->bsphere = get_bsphere<T>(primitives, left_index, right_index);
-        node->bbox    = {min_bbox, max_bbox};
+        const auto count    = right_index - left_index;
+        const auto num_bins = std::max(params.num_bins, 2);
 
-        if ((right_index - left_index) <= 8) {
-            return node;
+        best.num_bins = num_bins;
+
+        auto node_area = surface_area(node_bbox);
+        auto inv_area  = node_area > 0.0 ? 1.0 / node_area : 0.0;
+
+        // bin all three axes in one pass, bins[axis * num_bins + bin]
+        auto& scale = best.scale;
+
+        for (int axis = 0; axis < 3; axis++) {
+            auto extent = centroid_bbox.second[axis] - centroid_bbox.first[axis];
+            scale[axis] = extent > 0.0 ? num_bins / extent : 0.0;
         }
 
-        const auto begin = primitives.begin() + left_index;
-        const auto end   = primitives.begin() + right_index;
+        auto bins = bvh_parallel_reduce(
+            left_index, right_index, parallel, std::vector<BVHBin>(3 * num_bins),
+            [&](std::vector<BVHBin>& bins, size_t first, size_t last) {
+                for (auto i = first; i < last; i++) {
+                    for (int axis = 0; axis < 3; axis++) {
+                        auto bin = std::min(num_bins - 1,
+                                            (int)((build_prims[i].centroid[axis] -
+                                                   centroid_bbox.first[axis]) *
+                                                  scale[axis]));
+
+                        auto& b = bins[axis * num_bins + bin];
+                        b.count++;
+                        grow_bbox(b.bbox, build_prims[i].bbox);
+                    }
+                }
+            },
+            [](std::vector<BVHBin>& bins, const std::vector<BVHBin>& other) {
+                for (size_t i = 0; i < bins.size(); i++) {
+                    bins[i].count += other[i].count;
+                    grow_bbox(bins[i].bbox, other[i].bbox);
+                }
+            });
+
+        std::vector<double> right_cost(num_bins);
 
-        // find the longest axis
-        int    longest_axis = -1;
-        double longest_len  = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (scale[axis] == 0.0)
+                continue;
 
-        for (int i = 0; i < 3; i++) {
-            auto len = max_bbox[i] - min_bbox[i];
+            const auto axis_bins = bins.begin() + axis * num_bins;
 
-            if (len > longest_len) {
-                longest_len  = len;
-                longest_axis = i;
+            // sweep from the right, then from the left, evaluating every split plane
+            auto   right_bbox  = empty_bbox();
+            size_t right_count = 0;
+
+            for (int split = num_bins - 1; split > 0; split--) {
+                grow_bbox(right_bbox, axis_bins[split].bbox);
+                right_count += axis_bins[split].count;
+                right_cost[split - 1] =
+                    surface_area(right_bbox) * bvh_leaf_tests(right_count, params);
+            }
+
+            auto   left_bbox  = empty_bbox();
+            size_t left_count = 0;
+
+            for (int split = 0; split < num_bins - 1; split++) {
+                grow_bbox(left_bbox, axis_bins[split].bbox);
+                left_count += axis_bins[split].count;
+
+                if (left_count == 0 || left_count == count)
+                    continue;
+
+                auto cost = params.traversal_cost +
+                            params.intersection_cost * inv_area *
+                                (surface_area(left_bbox) * bvh_leaf_tests(left_count, params) +
+                                 right_cost[split]);
+
+                if (cost < best.cost) {
+                    best.cost  = cost;
+                    best.axis  = axis;
+                    best.split = split;
+                }
             }
         }
 
-        assert(longest_axis != -1);
+        // the child bounds are only kept for the winner, the spatial split search compares
+        // their overlap
+        if (best.axis != -1) {
+            const auto axis_bins = bins.begin() + best.axis * num_bins;
+
+            for (int bin = 0; bin < num_bins; bin++)
+                grow_bbox(bin <= best.split ? best.left_bbox : best.right_bbox,
+                          axis_bins[bin].bbox);
+        }
 
-        // sort along the longest axis
-        std::sort(begin, end, [longest_axis](auto tri1, auto tri2) {
-            return PrimitiveTraits::midpoint(tri1)[longest_axis] <
-                   PrimitiveTraits::midpoint(tri2)[longest_axis];
+        return best;
+    }
+
+    // moves the primitives left of the split to the front of the range, returns the index of
+    // the first one right of it
+    inline size_t bvh_partition_object_split(std::vector<BVHBuildPrimitive>& build_prims,
+                                             size_t left_index, size_t right_index,
+                                             const BVHObjectSplit& split,
+                                             const BoundingBox&    centroid_bbox) {
+        const auto begin = build_prims.begin() + left_index;
+        const auto end   = build_prims.begin() + right_index;
+
+        auto split_it = std::partition(begin, end, [&](const BVHBuildPrimitive& prim) {
+            auto axis = split.axis;
+            auto bin  = std::min(split.num_bins - 1,
+                                 (int)((prim.centroid[axis] - centroid_bbox.first[axis]) *
+                                       split.scale[axis]));
+
+            return bin <= split.split;
         });
 
+        return left_index + (split_it - begin);
+    }
+
+    inline uint32_t build_bvh_sah(std::vector<BVHBuildPrimitive>& build_prims, size_t left_index,
+                                  size_t right_index, const BVHBuildParams& params,
+                                  std::vector<LinearBVHNode>& nodes, int depth = 0);
+
+    // splits a range at its median centroid along the widest axis, returns the middle index
+    // and the axis
+    inline std::pair<size_t, int> bvh_median_split(std::vector<BVHBuildPrimitive>& build_prims,
+                                                   size_t left_index, size_t right_index,
+                                                   const BoundingBox& centroid_bbox) {
+        auto extent = centroid_bbox.second - centroid_bbox.first;
+
+        int axis = 0;
+
+        if (extent.y > extent[axis])
+            axis = 1;
+
+        if (extent.z > extent[axis])
+            axis = 2;
+
         auto middle = (left_index + right_index) / 2;
 
-        node->left_node  = build_bvh_generic<T>(primitives, left_index, middle);
-        node->right_node = build_bvh_generic<T>(primitives, middle, right_index);
+        std::nth_element(build_prims.begin() + left_index, build_prims.begin() + middle,
+                         build_prims.begin() + right_index,
+                         [axis](const BVHBuildPrimitive& a, const BVHBuildPrimitive& b) {
+                             return a.centroid[axis] < b.centroid[axis];
+                         });
 
-        return node;
+        return {middle, axis};
     }
 
-    struct BVHTraverseResult {
-        bool       hit = false;
-        double     t   = std::numeric_limits<double>::max();
-        glm::dvec3 hitnormal;
-    };
+    // builds both children of an inner node, big ranges build the second one on the pool
+    inline void build_bvh_sah_children(std::vector<BVHBuildPrimitive>& build_prims,
+                                       size_t left_index, size_t middle, size_t right_index,
+                                       const BVHBuildParams& params,
+                                       std::vector<LinearBVHNode>& nodes, uint32_t node_index,
+                                       int depth) {
+
+        if (right_index - left_index <= params.parallel_threshold) {
+            build_bvh_sah(build_prims, left_index, middle, params, nodes, depth + 1);
+
+            auto second_child =
+                build_bvh_sah(build_prims, middle, right_index, params, nodes, depth + 1);
+            nodes[node_index].second_child_offset = second_child;
+
+            return;
+        }
+
+        // the second subtree is built into its own node vector on the pool while this thread
+        // does the first one, then appended with its inner node offsets rebased
+        std::vector<LinearBVHNode> second_nodes;
+        second_nodes.reserve(2 * (right_index - middle));
+
+        TaskGroup tasks;
+        tasks.run([&] {
+            build_bvh_sah(build_prims, middle, right_index, params, second_nodes, depth + 1);
+        });
+
+        build_bvh_sah(build_prims, left_index, middle, params, nodes, depth + 1);
+
+        tasks.wait();
+
+        nodes[node_index].second_child_offset = append_bvh_subtree(nodes, second_nodes);
+    }
+
+    inline uint32_t build_bvh_sah(std::vector<BVHBuildPrimitive>& build_prims, size_t left_index,
+                                  size_t right_index, const BVHBuildParams& params,
+                                  std::vector<LinearBVHNode>& nodes, int depth) {
+
+        auto node_index = (uint32_t)nodes.size();
+        nodes.emplace_back();
+
+        const auto count    = right_index - left_index;
+        const bool parallel = count > params.parallel_threshold;
+
+        // not a structured binding, the binning lambda below captures centroid_bbox
+        BoundingBox node_bbox, centroid_bbox;
+        std::tie(node_bbox, centroid_bbox) =
+            bvh_range_bounds(build_prims, left_index, right_index, parallel);
+
+        nodes[node_index].set_bbox(node_bbox);
+
+        auto make_leaf = [&]() {
+            nodes[node_index].primitives_offset = (uint32_t)left_index;
+            nodes[node_index].num_primitives    = (uint16_t)count;
+            return node_index;
+        };
+
+        if (count <= 1)
+            return make_leaf();
+
+        // deep enough that the rest of the tree has to be balanced to stay within
+        // bvh_max_depth
+        if (depth >= bvh_median_split_depth) {
+            if (count <= params.max_leaf_size)
+                return make_leaf();
+
+            auto [middle, axis] =
+                bvh_median_split(build_prims, left_index, right_index, centroid_bbox);
+
+            nodes[node_index].axis = axis;
+
+            build_bvh_sah_children(build_prims, left_index, middle, right_index, params, nodes,
+                                   node_index, depth);
+
+            return node_index;
+        }
+
+        auto split = bvh_find_object_split(build_prims, left_index, right_index, node_bbox,
+                                           centroid_bbox, params, parallel);
+
+        auto leaf_cost = params.intersection_cost * bvh_leaf_tests(count, params);
+
+        if (count <= params.max_leaf_size && (split.axis == -1 || leaf_cost <= split.cost))
+            return make_leaf();
+
+        auto middle = (left_index + right_index) / 2;
+
+        if (split.axis != -1)
+            middle = bvh_partition_object_split(build_prims, left_index, right_index, split,
+                                                centroid_bbox);
+
+        // all centroids coincide, no plane can separate them so split by count instead
+        if (middle == left_index || middle == right_index)
+            middle = (left_index + right_index) / 2;
+
+        nodes[node_index].axis = split.axis == -1 ? 0 : split.axis;
+
+        build_bvh_sah_children(build_prims, left_index, middle, right_index, params, nodes,
+                               node_index, depth);
+
+        return node_index;
+    }
+
+    // linear bvh: primitives are sorted along a morton curve of their centroids and the
+    // hierarchy is emitted by splitting at the highest differing code bit. reorders
+    // build_prims like build_bvh_sah, see bvh.cpp
+    void build_bvh_lbvh(std::vector<BVHBuildPrimitive>& build_prims, size_t left_index,
+                        size_t right_index, const BVHBuildParams& params,
+                        std::vector<LinearBVHNode>& nodes);
+
+    // bounds of the part of build_prims[i] inside [lo, hi] along axis
+    using BVHClipFn = std::function<BoundingBox(size_t i, int axis, double lo, double hi)>;
+
+    // spatial split bvh, see sbvh.cpp. a primitive can end up in several leaves, so instead
+    // of reordering build_prims this returns the build_prims index of every leaf entry in
+    // leaf order, the leaves index that list offset by left_index
+    std::vector<size_t> build_bvh_sbvh(const std::vector<BVHBuildPrimitive>& build_prims,
+                                       size_t left_index, size_t right_index,
+                                       const BVHBuildParams& params, const BVHClipFn& clip,
+                                       std::vector<LinearBVHNode>& nodes);
 
     template <typename T>
-    bool dumb_bvh_traverse_generic(UnoptimizedBVHNode<T>* bvh, const std::vector<T>& primitives,
-                                   const glm::dvec3& origin, const glm::dvec3& dir,
-                                   BVHTraverseResult& res) {
-        BVHTraverseResult tmp_res;
-        glm::dvec3        hitnormal;
+    LinearBVH<T> build_bvh_generic(std::vector<T>& primitives, size_t left_index,
+                                   size_t right_index, BVHBuildParams params = {}) {
 
-        UnoptimizedBVHNode<T>* stack[2048] = {0};
-        int                    stack_ptr   = 0;
+        LinearBVH<T> bvh;
 
-        stack[stack_ptr++] = bvh;
+        if (right_index <= left_index)
+            return bvh;
 
-        while (stack_ptr != 0) {
-            auto node = stack[--stack_ptr];
-
-            double dummy;
-            if (ray_vs_aabb(origin, dir, node->bbox.first, node->bbox.second, dummy)) {
-                // if (ray_vs_sphere(origin, dir, node->bsphere.first, node->bsphere.second, dummy))
-                // {
-                bool is_leaf = (node->left_node == nullptr) && (node->right_node == nullptr);
-
-                if (is_leaf) {
-                    for (auto it = primitives.begin() + node->left_index;
-                         it != primitives.begin() + node->right_index; it++) {
-
-                        double t;
-                        if (it->intersect_ray(origin, dir, t)) {
-                            if (t < tmp_res.t) {
-                                tmp_res.hit = true;
-                                tmp_res.t   = t;
-                                hitnormal   = PrimitiveTraits::normal(*it, origin + dir * t);
-                            }
-                        }
-                    }
-                }
-                else {
-                    if (node->left_node != nullptr)
-                        stack[stack_ptr++] = node->left_node;
+        params.max_leaf_size = std::min(params.max_leaf_size, bvh_max_leaf_size);
 
-                    if (node->right_node != nullptr)
-                        stack[stack_ptr++] = node->right_node;
-                }
+        const bool parallel = right_index - left_index > params.parallel_threshold;
+        const auto grain    = parallel ? bvh_build_grain : right_index - left_index;
+
+        // build_prims is indexed like primitives so the node ranges line up with the
+        // primitive vector once it has been reordered below
+        std::vector<BVHBuildPrimitive> build_prims(right_index);
+
+        parallel_for(left_index, right_index, grain, [&](size_t first, size_t last) {
+            for (auto i = first; i < last; i++) {
+                auto bbox      = PrimitiveTraits::bbox(primitives[i]);
+                build_prims[i] = {bbox, 0.5 * (bbox.first + bbox.second), i};
             }
+        });
+
+        bvh.bbox = bvh_range_bounds(build_prims, left_index, right_index, parallel).first;
+
+        // a binary tree with n leaves has 2n - 1 nodes, and leaves hold at least one primitive
+        bvh.nodes.reserve(2 * (right_index - left_index));
+
+        std::vector<size_t> references;
+
+        switch (params.method) {
+        case BVHBuildMethod::SAH:
+            build_bvh_sah(build_prims, left_index, right_index, params, bvh.nodes);
+            break;
+        case BVHBuildMethod::LBVH:
+            build_bvh_lbvh(build_prims, left_index, right_index, params, bvh.nodes);
+            break;
+        case BVHBuildMethod::SBVH:
+            references = build_bvh_sbvh(
+                build_prims, left_index, right_index, params,
+                [&](size_t i, int axis, double lo, double hi) {
+                    return PrimitiveTraits::clipped_bbox(primitives[i], axis, lo, hi);
+                },
+                bvh.nodes);
+            break;
         }
 
-        if (tmp_res.hit) {
-            res.hit       = tmp_res.hit;
-            res.t         = tmp_res.t;
-            res.hitnormal = hitnormal;
+        bvh.nodes.shrink_to_fit();
+
+        // duplicated references grow the range, the primitives after it move back
+        if (params.method == BVHBuildMethod::SBVH) {
+            std::vector<T> referenced(primitives.begin(), primitives.begin() + left_index);
+            referenced.reserve(primitives.size() - (right_index - left_index) + references.size());
+
+            for (auto i : references)
+                referenced.push_back(primitives[i]);
+
+            referenced.insert(referenced.end(), primitives.begin() + right_index,
+                              primitives.end());
+
+            primitives.swap(referenced);
 
-            return true;
+            bvh.bsphere = get_bsphere<T>(primitives, left_index, left_index + references.size());
+
+            return bvh;
+        }
+
+        std::vector<T> unordered(primitives.begin() + left_index,
+                                 primitives.begin() + right_index);
+
+        parallel_for(left_index, right_index, grain, [&](size_t first, size_t last) {
+            for (auto i = first; i < last; i++)
+                primitives[i] = unordered[build_prims[i].index - left_index];
+        });
+
+        bvh.bsphere = get_bsphere<T>(primitives, left_index, right_index);
+
+        return bvh;
+    }
+
+    template <typename T>
+    BVHCostReport compute_bvh_cost(const LinearBVH<T>& bvh, const BVHBuildParams& params = {}) {
+        BVHCostReport report;
+
+        if (bvh.empty())
+            return report;
+
+        auto root_area = surface_area(bvh.nodes[0].bbox());
+
+        std::vector<std::pair<uint32_t, size_t>> stack{{0, 0}};
+
+        while (!stack.empty()) {
+            auto [index, depth] = stack.back();
+            stack.pop_back();
+
+            const auto& node       = bvh.nodes[index];
+            auto        area_ratio = root_area > 0.0 ? surface_area(node.bbox()) / root_area : 1.0;
+
+            report.num_nodes++;
+            report.max_depth = std::max(report.max_depth, depth);
+
+            if (node.is_leaf()) {
+                report.num_leaves++;
+                report.avg_leaf_size += node.num_primitives;
+                report.expected_prim_tests +=
+                    area_ratio * bvh_leaf_tests(node.num_primitives, params);
+            }
+            else {
+                report.expected_node_visits += area_ratio;
+
+                stack.push_back({index + 1, depth + 1});
+                stack.push_back({node.second_child_offset, depth + 1});
+            }
+        }
+
+        report.avg_leaf_size /= std::max<size_t>(report.num_leaves, 1);
+        report.sah_cost = params.traversal_cost * report.expected_node_visits +
+                          params.intersection_cost * report.expected_prim_tests;
+
+        return report;
+    }
+
+    template <typename R>
+    struct BVHTraverseResultT {
+        bool    hit = false;
+        R       t   = std::numeric_limits<R>::max();
+        Vec3<R> hitnormal;
+    };
+
+    using BVHTraverseResult = BVHTraverseResultT<Real>;
+
+    // walks the tree and calls leaf_fn(primitives_offset, num_primitives) for every leaf the
+    // ray passes through. children are visited front to back along the split axis, leaf_fn
+    // shrinks ray.tmax when it finds a hit and nodes entered beyond that are skipped. leaf_fn
+    // returns true to stop the traversal, which is then reported back to the caller. float
+    // rays test the float node bounds directly, double rays widen them first. root lets ray
+    // packets hand a subtree over to a single ray
+    template <typename R, typename LeafFn>
+    bool linear_bvh_traverse(const std::vector<LinearBVHNode>& nodes, RayT<R>& ray,
+                             LeafFn&& leaf_fn, uint32_t root = 0) {
+        if (nodes.empty())
+            return false;
+
+        uint32_t stack[bvh_stack_size(2)];
+        int      stack_ptr = 0;
+
+        stack[stack_ptr++] = root;
+
+        while (stack_ptr != 0) {
+            auto        index = stack[--stack_ptr];
+            const auto& node  = nodes[index];
+
+            R entry;
+            if (!ray_vs_aabb(ray, Vec3<R>(node.bbox_min), Vec3<R>(node.bbox_max), entry))
+                continue;
+
+            if (node.is_leaf()) {
+                if (leaf_fn(node.primitives_offset, node.num_primitives))
+                    return true;
+            }
+            else if (ray.sign[node.axis] != node.upper_first) {
+                stack[stack_ptr++] = index + 1;
+                stack[stack_ptr++] = node.second_child_offset;
+            }
+            else {
+                stack[stack_ptr++] = node.second_child_offset;
+                stack[stack_ptr++] = index + 1;
+            }
         }
 
         return false;
     }
 
+    // leaf routines shared by every tree layout. closest_hit_leaf records the nearest hit and
+    // keeps going, any_hit_leaf stops at the first primitive inside the ray interval
+    template <typename T, typename R>
+    auto closest_hit_leaf(const std::vector<T>& primitives, RayT<R>& ray, const T*& hitprim) {
+        return [&](uint32_t offset, uint16_t count) {
+            auto begin = primitives.begin() + offset;
+
+            for (auto it = begin; it != begin + count; it++) {
+                R t;
+                if (it->intersect_ray(ray.origin, ray.dir, t)) {
+                    if (t >= ray.tmin && t < ray.tmax) {
+                        ray.tmax = t;
+                        hitprim  = &*it;
+                    }
+                }
+            }
+
+            return false;
+        };
+    }
+
+    template <typename T, typename R>
+    auto any_hit_leaf(const std::vector<T>& primitives, const RayT<R>& ray) {
+        return [&](uint32_t offset, uint16_t count) {
+            auto begin = primitives.begin() + offset;
+
+            for (auto it = begin; it != begin + count; it++) {
+                R t;
+                if (it->intersect_ray(ray.origin, ray.dir, t) && t >= ray.tmin && t < ray.tmax)
+                    return true;
+            }
+
+            return false;
+        };
+    }
+
+    template <typename T, typename R>
+    bool finish_closest_hit(const RayT<R>& ray, const T* hitprim, BVHTraverseResultT<R>& res) {
+        if (hitprim == nullptr)
+            return false;
+
+        res.hit       = true;
+        res.t         = ray.tmax;
+        res.hitnormal = Vec3<R>(PrimitiveTraits::normal(*hitprim, ray.at(ray.tmax)));
+
+        return true;
+    }
+
+    template <typename T, typename R>
+    bool dumb_bvh_traverse_generic(const LinearBVH<T>& bvh, const std::vector<T>& primitives,
+                                   RayT<R> ray, BVHTraverseResultT<R>& res) {
+        const T* hitprim = nullptr;
+
+        linear_bvh_traverse(bvh.nodes, ray, closest_hit_leaf(primitives, ray, hitprim));
+
+        return finish_closest_hit(ray, hitprim, res);
+    }
+
+    template <typename T, typename R>
+    bool dumb_bvh_occluded_generic(const LinearBVH<T>& bvh, const std::vector<T>& primitives,
+                                   RayT<R> ray) {
+        return linear_bvh_traverse(bvh.nodes, ray, any_hit_leaf(primitives, ray));
+    }
+
 } // namespace Oxy::Renderer
@@ -0,0 +1,413 @@
+#include "renderer/accel/bvh_optimize.hpp"
+
+#include <array>
+
+#include "renderer/utils/thread_pool.hpp"
+
+namespace Oxy::Renderer {
+
+    constexpr size_t bvh_nodes_per_line = bvh_cache_line_size / sizeof(LinearBVHNode);
+
+    static size_t cache_line(size_t index) {
+        return index / bvh_nodes_per_line;
+    }
+
+    // node of the tree while it is optimized. leaves keep the index of their LinearBVHNode,
+    // inner nodes are reused for whatever treelet topology they end up in
+    struct BVHOptimizeNode {
+        BoundingBox bbox;
+        double      area = 0.0;
+        double      cost = 0.0; // unnormalized sah cost of the subtree
+
+        uint32_t left   = 0;
+        uint32_t right  = 0;
+        uint32_t height = 0; // levels below the node
+
+        size_t num_primitives = 0; // under the node, decides which subtrees fork
+        bool   leaf           = false;
+    };
+
+    struct BVHOptimizeTree {
+        const BVHBuildParams&        params;
+        std::vector<BVHOptimizeNode> nodes;
+
+        // recomputes an inner node from its children after they changed
+        void update(uint32_t index) {
+            auto&       node  = nodes[index];
+            const auto& left  = nodes[node.left];
+            const auto& right = nodes[node.right];
+
+            node.bbox = left.bbox;
+            grow_bbox(node.bbox, right.bbox);
+
+            node.area           = surface_area(node.bbox);
+            node.cost           = params.traversal_cost * node.area + left.cost + right.cost;
+            node.height         = 1 + std::max(left.height, right.height);
+            node.num_primitives = left.num_primitives + right.num_primitives;
+        }
+    };
+
+    // children come after their parent in the linear layout, so walking it backwards visits
+    // them first
+    static BVHOptimizeTree load_tree(const std::vector<LinearBVHNode>& nodes,
+                                     const BVHBuildParams&             params) {
+        BVHOptimizeTree tree{params, std::vector<BVHOptimizeNode>(nodes.size())};
+
+        for (auto index = (uint32_t)nodes.size(); index-- > 0;) {
+            const auto& source = nodes[index];
+            auto&       node   = tree.nodes[index];
+
+            if (source.is_leaf()) {
+                node.bbox = source.bbox();
+                node.area = surface_area(node.bbox);
+                node.cost = params.intersection_cost * node.area *
+                            bvh_leaf_tests(source.num_primitives, params);
+
+                node.num_primitives = source.num_primitives;
+                node.leaf           = true;
+            }
+            else {
+                node.left  = index + 1;
+                node.right = source.second_child_offset;
+
+                tree.update(index);
+            }
+        }
+
+        return tree;
+    }
+
+    static double sah_cost(const BVHOptimizeTree& tree) {
+        const auto& root = tree.nodes[0];
+        return root.area > 0.0 ? root.cost / root.area : 0.0;
+    }
+
+    // the treelet under one node and the cheapest way to arrange it, subsets of its leaves
+    // are bitmasks
+    struct BVHTreelet {
+        static constexpr int num_subsets = 1 << bvh_treelet_size;
+
+        std::array<uint32_t, bvh_treelet_size>     leaves;
+        std::array<uint32_t, bvh_treelet_size - 1> inner; // reused for the new topology
+        int                                        num_leaves = 0;
+        int                                        num_inner  = 0;
+
+        std::array<double, num_subsets>      cost;
+        std::array<uint8_t, num_subsets>     partition; // leaves going left for the best cost
+        std::array<BoundingBox, num_subsets> bbox;
+    };
+
+    // grows the treelet by opening the leaf with the largest area, as that is where a better
+    // topology saves the most
+    static void form_treelet(const BVHOptimizeTree& tree, uint32_t root, BVHTreelet& treelet) {
+        const auto& nodes = tree.nodes;
+
+        treelet.leaves[0]  = nodes[root].left;
+        treelet.leaves[1]  = nodes[root].right;
+        treelet.inner[0]   = root;
+        treelet.num_leaves = 2;
+        treelet.num_inner  = 1;
+
+        while (treelet.num_leaves < bvh_treelet_size) {
+            int largest = -1;
+
+            for (int i = 0; i < treelet.num_leaves; i++) {
+                const auto& node = nodes[treelet.leaves[i]];
+
+                if (node.leaf)
+                    continue;
+
+                if (largest == -1 || node.area > nodes[treelet.leaves[largest]].area)
+                    largest = i;
+            }
+
+            if (largest == -1)
+                break;
+
+            auto opened = treelet.leaves[largest];
+
+            treelet.inner[treelet.num_inner++]   = opened;
+            treelet.leaves[largest]              = nodes[opened].left;
+            treelet.leaves[treelet.num_leaves++] = nodes[opened].right;
+        }
+    }
+
+    // cheapest topology of every subset, built up from smaller subsets. each split is only
+    // tried once, with the lowest leaf on the left
+    static void optimize_treelet(const BVHOptimizeTree& tree, BVHTreelet& treelet) {
+        const auto full = (1 << treelet.num_leaves) - 1;
+
+        for (int subset = 1; subset <= full; subset++) {
+            auto lowest = subset & -subset;
+
+            if (subset == lowest) {
+                const auto& leaf = tree.nodes[treelet.leaves[__builtin_ctz(subset)]];
+
+                treelet.bbox[subset] = leaf.bbox;
+                treelet.cost[subset] = leaf.cost;
+
+                continue;
+            }
+
+            treelet.bbox[subset] = treelet.bbox[subset ^ lowest];
+            grow_bbox(treelet.bbox[subset], treelet.bbox[lowest]);
+
+            auto best_cost = std::numeric_limits<double>::max();
+
+            for (auto left = (subset - 1) & subset; left != 0; left = (left - 1) & subset) {
+                if ((left & lowest) == 0)
+                    continue;
+
+                auto cost = treelet.cost[left] + treelet.cost[subset ^ left];
+
+                if (cost < best_cost) {
+                    best_cost                 = cost;
+                    treelet.partition[subset] = (uint8_t)left;
+                }
+            }
+
+            treelet.cost[subset] =
+                tree.params.traversal_cost * surface_area(treelet.bbox[subset]) + best_cost;
+        }
+    }
+
+    static uint32_t treelet_height(const BVHOptimizeTree& tree, const BVHTreelet& treelet,
+                                   int subset) {
+        if ((subset & (subset - 1)) == 0)
+            return tree.nodes[treelet.leaves[__builtin_ctz(subset)]].height;
+
+        auto left = treelet.partition[subset];
+
+        return 1 + std::max(treelet_height(tree, treelet, left),
+                            treelet_height(tree, treelet, subset ^ left));
+    }
+
+    static uint32_t rebuild_treelet(BVHOptimizeTree& tree, const BVHTreelet& treelet, int subset,
+                                    int& next_inner) {
+        if ((subset & (subset - 1)) == 0)
+            return treelet.leaves[__builtin_ctz(subset)];
+
+        auto index = treelet.inner[next_inner++];
+        auto left  = treelet.partition[subset];
+
+        tree.nodes[index].left  = rebuild_treelet(tree, treelet, left, next_inner);
+        tree.nodes[index].right = rebuild_treelet(tree, treelet, subset ^ left, next_inner);
+
+        tree.update(index);
+
+        return index;
+    }
+
+    // depth is that of the node in the tree, a treelet is only rebuilt if it gets cheaper
+    // without pushing the leaves below bvh_max_depth
+    static bool restructure_node(BVHOptimizeTree& tree, uint32_t index, int depth) {
+        BVHTreelet treelet;
+        form_treelet(tree, index, treelet);
+
+        // two leaves only fit together one way
+        if (treelet.num_leaves < 3)
+            return false;
+
+        optimize_treelet(tree, treelet);
+
+        const auto full = (1 << treelet.num_leaves) - 1;
+
+        if (treelet.cost[full] >= tree.nodes[index].cost * (1.0 - 1e-9))
+            return false;
+
+        if (depth + treelet_height(tree, treelet, full) > (uint32_t)bvh_max_depth)
+            return false;
+
+        int next_inner = 0;
+        rebuild_treelet(tree, treelet, full, next_inner);
+
+        return true;
+    }
+
+    // bottom up, so every treelet is formed over subtrees that were already optimized. a
+    // treelet stays inside the subtree of its root, so big subtrees fork onto the pool
+    static size_t restructure_subtree(BVHOptimizeTree& tree, uint32_t index, int depth) {
+        const auto& node = tree.nodes[index];
+
+        if (node.leaf)
+            return 0;
+
+        auto left  = node.left;
+        auto right = node.right;
+
+        size_t restructured = 0;
+
+        if (node.num_primitives > tree.params.parallel_threshold) {
+            size_t right_restructured = 0;
+
+            TaskGroup tasks;
+            tasks.run([&] { right_restructured = restructure_subtree(tree, right, depth + 1); });
+
+            restructured = restructure_subtree(tree, left, depth + 1);
+
+            tasks.wait();
+
+            restructured += right_restructured;
+        }
+        else {
+            restructured = restructure_subtree(tree, left, depth + 1) +
+                           restructure_subtree(tree, right, depth + 1);
+        }
+
+        return restructured + restructure_node(tree, index, depth);
+    }
+
+    // the first child of a node at an even index shares its cache line, and a leaf first
+    // child at an even index shares its line with the second child. which subtree goes first
+    // decides the parity everything below starts at, so the expected lines of both parities
+    // are worked out bottom up and the cheaper order kept
+    struct BVHLineCosts {
+        std::array<double, 2> cost; // expected lines under the node at an even or odd index
+        std::array<bool, 2>   swap; // right child first at that parity
+    };
+
+    static void compute_line_costs(const BVHOptimizeTree& tree, uint32_t index,
+                                   std::vector<BVHLineCosts>& costs) {
+        const auto& node = tree.nodes[index];
+
+        if (node.leaf) {
+            costs[index] = {};
+            return;
+        }
+
+        compute_line_costs(tree, node.left, costs);
+        compute_line_costs(tree, node.right, costs);
+
+        for (int parity = 0; parity < 2; parity++) {
+            auto order_cost = [&](uint32_t first, uint32_t second) {
+                auto lines = parity == 0 ? 1.0 : (tree.nodes[first].leaf ? 1.0 : 2.0);
+
+                return node.area * lines + costs[first].cost[1 - parity] +
+                       costs[second].cost[parity];
+            };
+
+            auto in_order = order_cost(node.left, node.right);
+            auto swapped  = order_cost(node.right, node.left);
+
+            costs[index].cost[parity] = std::min(in_order, swapped);
+            costs[index].swap[parity] = swapped < in_order;
+        }
+    }
+
+    // splits on the axis the children are furthest apart on, so traversal still visits them
+    // front to back
+    static uint32_t emit_node(const BVHOptimizeTree& tree, const std::vector<BVHLineCosts>& costs,
+                              const std::vector<LinearBVHNode>& source, uint32_t index,
+                              std::vector<LinearBVHNode>& nodes) {
+        const auto& node       = tree.nodes[index];
+        auto        node_index = (uint32_t)nodes.size();
+
+        if (node.leaf) {
+            nodes.push_back(source[index]);
+            return node_index;
+        }
+
+        nodes.emplace_back();
+        nodes[node_index].set_bbox(node.bbox);
+
+        auto parity = node_index % 2;
+        auto first  = costs[index].swap[parity] ? node.right : node.left;
+        auto second = costs[index].swap[parity] ? node.left : node.right;
+
+        const auto& first_bbox  = tree.nodes[first].bbox;
+        const auto& second_bbox = tree.nodes[second].bbox;
+
+        auto offset = (first_bbox.first + first_bbox.second) -
+                      (second_bbox.first + second_bbox.second);
+
+        int axis = 0;
+
+        for (int i = 1; i < 3; i++)
+            if (std::abs(offset[i]) > std::abs(offset[axis]))
+                axis = i;
+
+        nodes[node_index].axis        = (uint8_t)axis;
+        nodes[node_index].upper_first = offset[axis] > 0.0;
+
+        emit_node(tree, costs, source, first, nodes);
+
+        auto second_child = emit_node(tree, costs, source, second, nodes);
+        nodes[node_index].second_child_offset = second_child;
+
+        return node_index;
+    }
+
+    double bvh_expected_cache_lines(const std::vector<LinearBVHNode>& nodes) {
+        if (nodes.empty())
+            return 0.0;
+
+        auto root_area = surface_area(nodes[0].bbox());
+
+        if (root_area <= 0.0)
+            return 1.0;
+
+        auto lines = 1.0;
+
+        for (uint32_t index = 0; index < nodes.size(); index++) {
+            const auto& node = nodes[index];
+
+            if (node.is_leaf())
+                continue;
+
+            auto first  = index + 1;
+            auto second = node.second_child_offset;
+
+            // both children are fetched whenever the node is hit
+            auto fetched = 0;
+
+            if (cache_line(first) != cache_line(index))
+                fetched++;
+
+            if (cache_line(second) != cache_line(index) &&
+                cache_line(second) != cache_line(first))
+                fetched++;
+
+            lines += fetched * surface_area(node.bbox()) / root_area;
+        }
+
+        return lines;
+    }
+
+    BVHOptimizeReport optimize_bvh(std::vector<LinearBVHNode>& nodes,
+                                   const BVHBuildParams&       params) {
+        BVHOptimizeReport report;
+
+        if (nodes.empty())
+            return report;
+
+        auto tree = load_tree(nodes, params);
+
+        report.sah_cost_before    = sah_cost(tree);
+        report.cache_lines_before = bvh_expected_cache_lines(nodes);
+
+        for (; report.passes < params.optimize_passes; report.passes++) {
+            auto restructured = restructure_subtree(tree, 0, 0);
+
+            if (restructured == 0)
+                break;
+
+            report.treelets_restructured += restructured;
+        }
+
+        std::vector<BVHLineCosts> costs(tree.nodes.size());
+        compute_line_costs(tree, 0, costs);
+
+        std::vector<LinearBVHNode> optimized;
+        optimized.reserve(nodes.size());
+
+        emit_node(tree, costs, nodes, 0, optimized);
+
+        nodes.swap(optimized);
+
+        report.sah_cost_after    = sah_cost(tree);
+        report.cache_lines_after = bvh_expected_cache_lines(nodes);
+
+        return report;
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "renderer/accel/bvh.hpp"
+
+namespace Oxy::Renderer {
+
+    // treelets of up to this many subtrees are rebuilt into their cheapest topology, which
+    // takes 3^n steps per node
+    constexpr int bvh_treelet_size = 7;
+
+    // nodes are assumed to share cache lines of this size, counting from the first node
+    constexpr size_t bvh_cache_line_size = 64;
+
+    struct BVHOptimizeReport {
+        int    passes                = 0;
+        size_t treelets_restructured = 0;
+
+        double sah_cost_before = 0.0;
+        double sah_cost_after  = 0.0;
+
+        // expected cache lines a ray touches, see bvh_expected_cache_lines
+        double cache_lines_before = 0.0;
+        double cache_lines_after  = 0.0;
+    };
+
+    inline std::ostream& operator<<(std::ostream& os, const BVHOptimizeReport& report) {
+        return os << "sah cost " << report.sah_cost_before << " -> " << report.sah_cost_after
+                  << ", " << report.cache_lines_before << " -> " << report.cache_lines_after
+                  << " cache lines per ray, " << report.treelets_restructured
+                  << " treelets restructured in " << report.passes << " passes";
+    }
+
+    // cache lines a ray that hits the root is expected to touch on its way through the tree,
+    // counting one whenever it steps to a node outside the line of its parent
+    double bvh_expected_cache_lines(const std::vector<LinearBVHNode>& nodes);
+
+    // restructures the tree in treelets after Karras and Aila, "Fast parallel construction of
+    // high-quality bounding volume hierarchies", then lays it out again depth first with the
+    // child more likely to be visited right after its parent. leaves keep their primitive
+    // ranges, so this works on any built tree before its leaves are packed
+    BVHOptimizeReport optimize_bvh(std::vector<LinearBVHNode>& nodes, const BVHBuildParams& params);
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "renderer/accel/bvh.hpp"
+
+namespace Oxy::Renderer {
+
+    // what refitting needs on top of the flattened tree: parent links, the leaf holding every
+    // primitive, and the surface area sums of the sah cost so it can be tracked per refit
+    struct BVHRefitState {
+        static constexpr uint32_t no_parent = std::numeric_limits<uint32_t>::max();
+
+        std::vector<uint32_t> parents;
+        std::vector<uint32_t> leaf_of_primitive;
+
+        double inner_area = 0.0; // summed surface area of the inner nodes
+        double leaf_area  = 0.0; // summed surface area of the leaves, times their leaf tests
+
+        // same cost as compute_bvh_cost, for the current boxes
+        double sah_cost(const std::vector<LinearBVHNode>& nodes,
+                        const BVHBuildParams&             params) const {
+            if (nodes.empty())
+                return 0.0;
+
+            auto root_area = surface_area(nodes[0].bbox());
+
+            if (root_area <= 0.0)
+                return 0.0;
+
+            return (params.traversal_cost * inner_area + params.intersection_cost * leaf_area) /
+                   root_area;
+        }
+    };
+
+    template <typename T>
+    BVHRefitState make_bvh_refit_state(const LinearBVH<T>& bvh, size_t num_primitives,
+                                       const BVHBuildParams& params) {
+        BVHRefitState state;
+
+        state.parents.resize(bvh.nodes.size(), BVHRefitState::no_parent);
+        state.leaf_of_primitive.resize(num_primitives, BVHRefitState::no_parent);
+
+        for (uint32_t index = 0; index < bvh.nodes.size(); index++) {
+            const auto& node = bvh.nodes[index];
+            auto        area = surface_area(node.bbox());
+
+            if (node.is_leaf()) {
+                for (auto i = node.primitives_offset;
+                     i < node.primitives_offset + node.num_primitives; i++)
+                    state.leaf_of_primitive[i] = index;
+
+                state.leaf_area += area * bvh_leaf_tests(node.num_primitives, params);
+            }
+            else {
+                state.parents[index + 1]                = index;
+                state.parents[node.second_child_offset] = index;
+
+                state.inner_area += area;
+            }
+        }
+
+        return state;
+    }
+
+    // refits the leaves holding the changed primitives, then walks up towards the root and
+    // stops as soon as a box comes out unchanged, so the cost is O(changed * depth). the
+    // topology and bsphere stay as built, bbox becomes the rounded box of the root
+    template <typename T>
+    void refit_bvh(LinearBVH<T>& bvh, BVHRefitState& state, const std::vector<T>& primitives,
+                   const std::vector<uint32_t>& changed, const BVHBuildParams& params) {
+
+        // stores the float rounded box and keeps the area sums up to date, returns false if
+        // the node did not change
+        auto set_node_bbox = [&](uint32_t index, const BoundingBox& bbox) {
+            auto& node = bvh.nodes[index];
+            auto  old  = node;
+
+            node.set_bbox(bbox);
+
+            if (node.bbox_min == old.bbox_min && node.bbox_max == old.bbox_max)
+                return false;
+
+            auto delta = surface_area(node.bbox()) - surface_area(old.bbox());
+
+            if (node.is_leaf())
+                state.leaf_area += delta * bvh_leaf_tests(node.num_primitives, params);
+            else
+                state.inner_area += delta;
+
+            return true;
+        };
+
+        for (auto primitive : changed) {
+            auto index = state.leaf_of_primitive[primitive];
+
+            const auto& leaf = bvh.nodes[index];
+            auto        bbox = get_bbox(primitives, leaf.primitives_offset,
+                                        leaf.primitives_offset + leaf.num_primitives);
+
+            if (!set_node_bbox(index, bbox))
+                continue;
+
+            for (index = state.parents[index]; index != BVHRefitState::no_parent;
+                 index = state.parents[index]) {
+
+                auto node_bbox = bvh.nodes[index + 1].bbox();
+                grow_bbox(node_bbox, bvh.nodes[bvh.nodes[index].second_child_offset].bbox());
+
+                if (!set_node_bbox(index, node_bbox))
+                    break;
+            }
+        }
+
+        if (!bvh.empty())
+            bvh.bbox = bvh.nodes[0].bbox();
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderer/accel/bvh.hpp"
+#include "renderer/accel/wide_bvh.hpp"
+
+namespace Oxy::Renderer {
+
+    constexpr int compressed_bvh_width = 8;
+
+    // a leaf child spans at most this many consecutive blocks, builds for the compressed
+    // layout cap max_leaf_size to fit
+    constexpr size_t compressed_bvh_max_leaf_blocks = 255;
+
+    // N children per node with their bounds quantized to 8 bits inside the node box, which is
+    // stored as a float origin and a power of two step per axis. the inner children of a node
+    // are stored consecutively from node_base and the blocks of its leaf children
+    // consecutively from leaf_base, so no per child index is needed. 80 bytes for N = 8
+    // against 256 for WideBVHNode<8>
+    template <int N>
+    struct alignas(16) CompressedBVHNode {
+        static_assert(N <= 8, "inner_mask has one bit per child");
+
+        float   origin[3];
+        int8_t  exponent[3]; // step of the quantized grid is 2^exponent
+        uint8_t inner_mask;  // bit i is set if child i is an inner node
+
+        uint32_t node_base;
+        uint32_t leaf_base;
+
+        uint8_t leaf_blocks[N]; // blocks of leaf children, 0 for inner and empty children
+        uint8_t qmin[3][N];
+        uint8_t qmax[3][N];
+
+        bool is_inner(int i) const { return (inner_mask >> i) & 1; }
+        bool is_leaf(int i) const { return leaf_blocks[i] != 0; }
+        bool is_empty(int i) const { return !is_inner(i) && !is_leaf(i); }
+
+        // children that are inner nodes or leaves, the rest are padding
+        int child_mask() const {
+            int mask = inner_mask;
+
+            for (int i = 0; i < N; i++)
+                if (leaf_blocks[i] != 0)
+                    mask |= 1 << i;
+
+            return mask;
+        }
+    };
+
+    static_assert(sizeof(CompressedBVHNode<8>) == 80);
+
+    template <typename T, int N>
+    struct CompressedBVH {
+        std::vector<CompressedBVHNode<N>> nodes;
+
+        BoundingBox bbox = empty_bbox();
+
+        int leaf_width = 1; // primitives per leaf block, leaf_fn gets counts in primitives
+
+        bool empty() const { return nodes.empty(); }
+    };
+
+    // the exponents are kept within the normal float range, so the step is built directly
+    inline float compressed_bvh_step(int exponent) {
+        uint32_t bits = (uint32_t)(exponent + 127) << 23;
+
+        float step;
+        std::memcpy(&step, &bits, sizeof(step));
+
+        return step;
+    }
+
+    // the product is exact, so this rounds the same whether or not it is contracted to an fma
+    // and the builder sees exactly the bounds the traversal decodes
+    inline float decode_compressed_bound(float origin, float step, int q) {
+        return origin + (float)q * step;
+    }
+
+    // quantizes the child boxes of one node, rounding outwards so every decoded box contains
+    // the float box it was made from
+    template <int N>
+    void quantize_compressed_node(CompressedBVHNode<N>& node, const LinearBVHNode* const* children,
+                                  int num_children) {
+        for (int axis = 0; axis < 3; axis++) {
+            auto lo = std::numeric_limits<float>::max();
+            auto hi = std::numeric_limits<float>::lowest();
+
+            for (int i = 0; i < num_children; i++) {
+                lo = std::min(lo, children[i]->bbox_min[axis]);
+                hi = std::max(hi, children[i]->bbox_max[axis]);
+            }
+
+            // smallest step whose grid still reaches the top of the node box
+            int exponent = -126;
+
+            if (hi > lo) {
+                auto extent = ((double)hi - (double)lo) / 255.0;
+                exponent    = std::clamp((int)std::ceil(std::log2(extent)) - 1, -126, 127);
+            }
+
+            while (exponent < 127 &&
+                   decode_compressed_bound(lo, compressed_bvh_step(exponent), 255) < hi)
+                exponent++;
+
+            auto step = compressed_bvh_step(exponent);
+
+            node.origin[axis]   = lo;
+            node.exponent[axis] = (int8_t)exponent;
+
+            for (int i = 0; i < N; i++) {
+                if (i >= num_children) {
+                    node.qmin[axis][i] = 0;
+                    node.qmax[axis][i] = 0;
+                    continue;
+                }
+
+                auto child_lo = children[i]->bbox_min[axis];
+                auto child_hi = children[i]->bbox_max[axis];
+
+                auto q_lo = (int)std::clamp(std::floor((child_lo - (double)lo) / step), 0.0, 255.0);
+                auto q_hi = (int)std::clamp(std::ceil((child_hi - (double)lo) / step), 0.0, 255.0);
+
+                while (q_lo > 0 && decode_compressed_bound(lo, step, q_lo) > child_lo)
+                    q_lo--;
+
+                while (q_hi < 255 && decode_compressed_bound(lo, step, q_hi) < child_hi)
+                    q_hi++;
+
+                node.qmin[axis][i] = (uint8_t)q_lo;
+                node.qmax[axis][i] = (uint8_t)q_hi;
+            }
+        }
+    }
+
+    // fills node wide_index from the binary subtree at index, appending its inner children to
+    // nodes and the blocks of its leaf children to out_blocks
+    template <int N, typename Block>
+    void compress_bvh_node(const std::vector<LinearBVHNode>& binary, uint32_t index,
+                           uint32_t wide_index, const std::vector<Block>& blocks, int leaf_width,
+                           std::vector<CompressedBVHNode<N>>& nodes,
+                           std::vector<Block>&                out_blocks) {
+
+        uint32_t children[N];
+        int      num_children = collapse_bvh_children<N>(binary, index, children);
+
+        const LinearBVHNode* child_nodes[N];
+
+        for (int i = 0; i < num_children; i++)
+            child_nodes[i] = &binary[children[i]];
+
+        CompressedBVHNode<N> node{};
+
+        quantize_compressed_node<N>(node, child_nodes, num_children);
+
+        node.node_base = (uint32_t)nodes.size();
+        node.leaf_base = (uint32_t)out_blocks.size();
+
+        uint32_t inner_children[N];
+        int      num_inner = 0;
+
+        for (int i = 0; i < num_children; i++) {
+            const auto& child = *child_nodes[i];
+
+            if (!child.is_leaf()) {
+                node.inner_mask |= 1 << i;
+                inner_children[num_inner++] = children[i];
+                continue;
+            }
+
+            auto first = blocks.begin() + child.primitives_offset;
+            auto count = (child.num_primitives + leaf_width - 1) / leaf_width;
+
+            out_blocks.insert(out_blocks.end(), first, first + count);
+            node.leaf_blocks[i] = (uint8_t)count;
+        }
+
+        nodes[wide_index] = node;
+
+        // siblings first, then each subtree, the recursion below appends to nodes
+        nodes.resize(nodes.size() + num_inner);
+
+        for (int i = 0; i < num_inner; i++)
+            compress_bvh_node<N>(binary, inner_children[i], node.node_base + i, blocks, leaf_width,
+                                 nodes, out_blocks);
+    }
+
+    // compresses a binary tree whose leaves point at runs of blocks, leaf_width primitives
+    // each. the blocks are reordered to the order the compressed leaves need, so the binary
+    // leaves no longer point at the right blocks afterwards
+    template <int N, typename T, typename Block>
+    CompressedBVH<T, N> compress_bvh(const LinearBVH<T>& bvh, std::vector<Block>& blocks,
+                                     int leaf_width) {
+        CompressedBVH<T, N> compressed;
+
+        compressed.bbox       = bvh.bbox;
+        compressed.leaf_width = leaf_width;
+
+        if (bvh.empty())
+            return compressed;
+
+        std::vector<Block> out_blocks;
+        out_blocks.reserve(blocks.size());
+
+        compressed.nodes.reserve(bvh.nodes.size() / (N - 1) + 1);
+        compressed.nodes.emplace_back();
+
+        compress_bvh_node<N>(bvh.nodes, 0, 0, blocks, leaf_width, compressed.nodes, out_blocks);
+
+        compressed.nodes.shrink_to_fit();
+        blocks.swap(out_blocks);
+
+        return compressed;
+    }
+
+    // decodes the child boxes and tests the ray against them, same contract as
+    // intersect_wide_node
+    template <int N>
+    inline int intersect_compressed_node(const CompressedBVHNode<N>& node, const WideBVHRay& ray,
+                                         float tmax, float* dist) {
+        int mask = 0;
+
+        float step[3];
+
+        for (int axis = 0; axis < 3; axis++)
+            step[axis] = compressed_bvh_step(node.exponent[axis]);
+
+        for (int i = 0; i < N; i++) {
+            float t_near = ray.tmin;
+            float t_far  = tmax;
+
+            for (int axis = 0; axis < 3; axis++) {
+                auto origin = node.origin[axis];
+
+                auto lo = decode_compressed_bound(origin, step[axis], node.qmin[axis][i]);
+                auto hi = decode_compressed_bound(origin, step[axis], node.qmax[axis][i]);
+
+                auto t0 = (lo - ray.origin[axis]) * ray.inv_dir[axis];
+                auto t1 = (hi - ray.origin[axis]) * ray.inv_dir[axis];
+
+                t_near = std::max(t_near, std::min(t0, t1));
+                t_far  = std::min(t_far, std::max(t0, t1));
+            }
+
+            dist[i] = t_near;
+
+            if (t_near <= t_far * wide_bvh_box_epsilon)
+                mask |= 1 << i;
+        }
+
+        return mask;
+    }
+
+#ifdef __AVX2__
+    template <>
+    inline int intersect_compressed_node<8>(const CompressedBVHNode<8>& node,
+                                            const WideBVHRay& ray, float tmax, float* dist) {
+        auto t_near = _mm256_set1_ps(ray.tmin);
+        auto t_far  = _mm256_set1_ps(tmax);
+
+        auto decode = [](const uint8_t* q, __m256 origin, __m256 step) {
+            auto bytes = _mm_loadl_epi64((const __m128i*)q);
+            auto value = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+
+            return _mm256_add_ps(origin, _mm256_mul_ps(value, step));
+        };
+
+        for (int axis = 0; axis < 3; axis++) {
+            auto node_origin = _mm256_set1_ps(node.origin[axis]);
+            auto step        = _mm256_set1_ps(compressed_bvh_step(node.exponent[axis]));
+
+            auto origin  = _mm256_set1_ps(ray.origin[axis]);
+            auto inv_dir = _mm256_set1_ps(ray.inv_dir[axis]);
+
+            auto lo = decode(node.qmin[axis], node_origin, step);
+            auto hi = decode(node.qmax[axis], node_origin, step);
+
+            auto t0 = _mm256_mul_ps(_mm256_sub_ps(lo, origin), inv_dir);
+            auto t1 = _mm256_mul_ps(_mm256_sub_ps(hi, origin), inv_dir);
+
+            t_near = _mm256_max_ps(_mm256_min_ps(t0, t1), t_near);
+            t_far  = _mm256_min_ps(_mm256_max_ps(t0, t1), t_far);
+        }
+
+        _mm256_storeu_ps(dist, t_near);
+
+        t_far = _mm256_mul_ps(t_far, _mm256_set1_ps(wide_bvh_box_epsilon));
+
+        return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+    }
+#endif
+
+    // same contract as wide_bvh_traverse, leaf_fn gets the first block of a leaf and its
+    // primitive count rounded up to whole blocks. padding lanes of the blocks never hit
+    template <int N, typename T, typename R, typename LeafFn>
+    bool compressed_bvh_traverse(const CompressedBVH<T, N>& bvh, RayT<R>& ray, LeafFn&& leaf_fn) {
+        if (bvh.nodes.empty())
+            return false;
+
+        WideBVHRay wide_ray(ray);
+
+        WideBVHStackEntry stack[bvh_stack_size(N)];
+        int               stack_ptr = 0;
+
+        stack[stack_ptr++] = {0, 0, wide_ray.tmin};
+
+        while (stack_ptr != 0) {
+            auto entry = stack[--stack_ptr];
+
+            if (entry.dist > ray.tmax * wide_bvh_box_epsilon)
+                continue;
+
+            if (entry.num_primitives != 0) {
+                if (leaf_fn(entry.index, entry.num_primitives))
+                    return true;
+
+                continue;
+            }
+
+            const auto& node = bvh.nodes[entry.index];
+
+            alignas(32) float dist[N];
+            auto mask = intersect_compressed_node<N>(node, wide_ray, clamp_to_float(ray.tmax),
+                                                     dist);
+
+            mask &= node.child_mask();
+
+            // the children are only addressed by their rank among the inner or leaf children
+            uint32_t child_index[N];
+            uint32_t next_node = node.node_base;
+            uint32_t next_leaf = node.leaf_base;
+
+            for (int i = 0; i < N; i++) {
+                child_index[i] = node.is_inner(i) ? next_node++ : next_leaf;
+                next_leaf += node.leaf_blocks[i];
+            }
+
+            // sort the hit children far to near, so the nearest one ends up on top of the stack
+            int hit_children[N];
+            int num_hit = 0;
+
+            for (; mask != 0; mask &= mask - 1) {
+                auto i = __builtin_ctz(mask);
+
+                int slot = num_hit++;
+                while (slot > 0 && dist[hit_children[slot - 1]] < dist[i]) {
+                    hit_children[slot] = hit_children[slot - 1];
+                    slot--;
+                }
+
+                hit_children[slot] = i;
+            }
+
+            for (int i = 0; i < num_hit; i++) {
+                auto child = hit_children[i];
+                auto count = (uint16_t)(node.leaf_blocks[child] * bvh.leaf_width);
+
+                stack[stack_ptr++] = {child_index[child], count, dist[child]};
+            }
+        }
+
+        return false;
+    }
+
+} // namespace Oxy::Renderer
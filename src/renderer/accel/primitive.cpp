@@ -1,20 +1,26 @@
 #include "renderer/accel/primitive.hpp"
 
+#include <limits>
+
 namespace Oxy::Renderer {
 
-    bool Triangle::intersect_ray(const glm::dvec3& orig, const glm::dvec3& dir, double& t) const {
-        auto v0v1 = m_p1 - m_p0;
-        auto v0v2 = m_p2 - m_p0;
+    // the vertices stay double, they are converted to the precision of the ray per test
+    template <typename R>
+    bool Triangle::intersect_ray(const Vec3<R>& orig, const Vec3<R>& dir, R& t) const {
+        Vec3<R> p0(m_p0);
+
+        auto v0v1 = Vec3<R>(m_p1) - p0;
+        auto v0v2 = Vec3<R>(m_p2) - p0;
         auto pvec = glm::cross(dir, v0v2);
 
         auto det = glm::dot(v0v1, pvec);
 
-        if (std::fabs(det) < 1e-9)
+        if (std::fabs(det) < R(1e-9))
             return false;
 
-        auto inv_det = 1.0 / det;
+        auto inv_det = R(1) / det;
 
-        auto tvec = orig - m_p0;
+        auto tvec = orig - p0;
         auto qvec = glm::cross(tvec, v0v1);
 
         auto u = glm::dot(tvec, pvec) * inv_det;
@@ -28,27 +34,68 @@ namespace Oxy::Renderer {
         return true;
     }
 
-    bool Sphere::intersect_ray(const glm::dvec3& orig, const glm::dvec3& dir, double& t) const {
-        auto oc   = orig - m_center;
+    BoundingBox Triangle::clipped_bbox(int axis, double lo, double hi) const {
+        BoundingBox bbox = {glm::dvec3(std::numeric_limits<double>::max()),
+                            glm::dvec3(std::numeric_limits<double>::lowest())};
+
+        auto grow = [&](const glm::dvec3& point) {
+            bbox.first  = glm::min(bbox.first, point);
+            bbox.second = glm::max(bbox.second, point);
+        };
+
+        const glm::dvec3* vertices[3] = {&m_p0, &m_p1, &m_p2};
+
+        // the vertices inside the slab plus every point where an edge crosses one of its planes
+        for (int i = 0; i < 3; i++) {
+            const auto& a = *vertices[i];
+            const auto& b = *vertices[(i + 1) % 3];
+
+            if (a[axis] >= lo && a[axis] <= hi)
+                grow(a);
+
+            for (auto plane : {lo, hi}) {
+                if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane)) {
+                    auto point  = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+                    point[axis] = plane;
+
+                    grow(point);
+                }
+            }
+        }
+
+        return bbox;
+    }
+
+    template <typename R>
+    bool Sphere::intersect_ray(const Vec3<R>& orig, const Vec3<R>& dir, R& t) const {
+        auto oc   = orig - Vec3<R>(m_center);
         auto a    = glm::dot(dir, dir);
-        auto b    = 2.0 * glm::dot(oc, dir);
-        auto c    = glm::dot(oc, oc) - m_radius * m_radius;
+        auto b    = R(2) * glm::dot(oc, dir);
+        auto c    = glm::dot(oc, oc) - R(m_radius * m_radius);
         auto disc = b * b - 4 * a * c;
 
         if (disc < 0)
             return false;
 
-        auto t1 = (-b + std::sqrt(disc)) / (2.0 * a);
-        auto t2 = (-b - std::sqrt(disc)) / (2.0 * a);
+        auto t_near = (-b - std::sqrt(disc)) / (R(2) * a);
+        auto t_far  = (-b + std::sqrt(disc)) / (R(2) * a);
+
+        if (t_far < 0) // the whole sphere is behind the ray
+            return false;
 
-        if (t1 < 0) // inside the sphere, return the far point
-            t = t2;
-        else
-            t = std::min(t1, t2);
+        // inside the sphere, return the far point
+        t = t_near < 0 ? t_far : t_near;
 
         return true;
     }
 
+    template bool Triangle::intersect_ray(const Vec3<float>&, const Vec3<float>&, float&) const;
+    template bool Triangle::intersect_ray(const Vec3<double>&, const Vec3<double>&,
+                                          double&) const;
+
+    template bool Sphere::intersect_ray(const Vec3<float>&, const Vec3<float>&, float&) const;
+    template bool Sphere::intersect_ray(const Vec3<double>&, const Vec3<double>&, double&) const;
+
     BoundingBox get_transformed_bbox(const BoundingBox& bbox, const glm::dmat4& transform) {
         auto& [min, max] = bbox;
 
@@ -97,7 +144,13 @@ namespace Oxy::Renderer {
 
     BoundingSphere get_transformed_bsphere(const BoundingSphere& bsphere,
                                            const glm::dmat4&     transform) {
-        return {transform * glm::dvec4(bsphere.first, 1.0), bsphere.second};
+        // the radius grows with the largest scale along any axis
+        double scale = 0.0;
+
+        for (int axis = 0; axis < 3; axis++)
+            scale = std::max(scale, glm::length(glm::dvec3(transform[axis])));
+
+        return {transform * glm::dvec4(bsphere.first, 1.0), bsphere.second * scale};
     }
 
 } // namespace Oxy::Renderer
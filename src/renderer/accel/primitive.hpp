@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 
 #include "renderer/accel/primitive_traits.hpp"
+#include "renderer/utils/real.hpp"
 
 namespace Oxy::Renderer {
 
@@ -50,7 +51,13 @@ namespace Oxy::Renderer {
             return {middle, radius * 2};
         }
 
-        bool intersect_ray(const glm::dvec3& orig, const glm::dvec3& dir, double& t) const;
+        // bounds of the polygon left after clipping the triangle to [lo, hi] along axis, empty
+        // if the triangle does not reach into the slab
+        BoundingBox clipped_bbox(int axis, double lo, double hi) const;
+
+        // instantiated for float and double in primitive.cpp
+        template <typename R>
+        bool intersect_ray(const Vec3<R>& orig, const Vec3<R>& dir, R& t) const;
 
     private:
         inline void compute_normal() {
@@ -89,6 +96,9 @@ namespace Oxy::Renderer {
             : m_center(center)
             , m_radius(radius) {}
 
+        const auto& center() const { return m_center; }
+        double      radius() const { return m_radius; }
+
         const auto normal(glm::dvec3 point) const { return (point - m_center) / m_radius; }
 
         const auto& midpoint() const { return m_center; }
@@ -99,7 +109,9 @@ namespace Oxy::Renderer {
 
         BoundingSphere bsphere() const { return {m_center, m_radius}; }
 
-        bool intersect_ray(const glm::dvec3& orig, const glm::dvec3& dir, double& t) const;
+        // instantiated for float and double in primitive.cpp
+        template <typename R>
+        bool intersect_ray(const Vec3<R>& orig, const Vec3<R>& dir, R& t) const;
 
     private:
         glm::dvec3 m_center;
@@ -110,44 +122,50 @@ namespace Oxy::Renderer {
     using Sphere   = Primitive<Primitives::Sphere>;
 
     template <>
-    inline BoundingBox PrimitiveTraits::bbox(Triangle tri) {
+    inline BoundingBox PrimitiveTraits::bbox(const Triangle& tri) {
         return tri.bbox();
     }
 
     template <>
-    inline BoundingSphere PrimitiveTraits::bsphere(Triangle tri) {
+    inline BoundingSphere PrimitiveTraits::bsphere(const Triangle& tri) {
         return tri.bsphere();
     }
 
     template <>
-    inline glm::dvec3 PrimitiveTraits::midpoint(Triangle tri) {
+    inline glm::dvec3 PrimitiveTraits::midpoint(const Triangle& tri) {
         return tri.midpoint();
     }
 
     template <>
-    inline glm::dvec3 PrimitiveTraits::normal(Triangle tri, const glm::dvec3& hitpos) {
+    inline glm::dvec3 PrimitiveTraits::normal(const Triangle& tri, const glm::dvec3& hitpos) {
         return tri.normal(hitpos);
     }
 
+    template <>
+    inline BoundingBox PrimitiveTraits::clipped_bbox(const Triangle& tri, int axis, double lo,
+                                                     double hi) {
+        return tri.clipped_bbox(axis, lo, hi);
+    }
+
     //
 
     template <>
-    inline BoundingBox PrimitiveTraits::bbox(Sphere sph) {
+    inline BoundingBox PrimitiveTraits::bbox(const Sphere& sph) {
         return sph.bbox();
     }
 
     template <>
-    inline BoundingSphere PrimitiveTraits::bsphere(Sphere sph) {
+    inline BoundingSphere PrimitiveTraits::bsphere(const Sphere& sph) {
         return sph.bsphere();
     }
 
     template <>
-    inline glm::dvec3 PrimitiveTraits::midpoint(Sphere sph) {
+    inline glm::dvec3 PrimitiveTraits::midpoint(const Sphere& sph) {
         return sph.midpoint();
     }
 
     template <>
-    inline glm::dvec3 PrimitiveTraits::normal(Sphere sph, const glm::dvec3& hitpos) {
+    inline glm::dvec3 PrimitiveTraits::normal(const Sphere& sph, const glm::dvec3& hitpos) {
         return sph.normal(hitpos);
     }
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <utility>
 
 #include <glm/glm.hpp>
@@ -10,7 +11,7 @@ namespace Oxy::Renderer::PrimitiveTraits {
     using BoundingSphere = std::pair<glm::dvec3, double>;
 
     template <typename T>
-    BoundingBox bbox(T prim) = delete;
+    BoundingBox bbox(const T& prim) = delete;
 
     template <typename T>
     BoundingBox bbox(T* prim) = delete;
@@ -18,7 +19,7 @@ namespace Oxy::Renderer::PrimitiveTraits {
     //
 
     template <typename T>
-    BoundingSphere bsphere(T prim) = delete;
+    BoundingSphere bsphere(const T& prim) = delete;
 
     template <typename T>
     BoundingSphere bsphere(T* prim) = delete;
@@ -26,7 +27,7 @@ namespace Oxy::Renderer::PrimitiveTraits {
     //
 
     template <typename T>
-    glm::dvec3 midpoint(T prim) = delete;
+    glm::dvec3 midpoint(const T& prim) = delete;
 
     template <typename T>
     glm::dvec3 midpoint(T* prim) = delete;
@@ -34,9 +35,24 @@ namespace Oxy::Renderer::PrimitiveTraits {
     //
 
     template <typename T>
-    glm::dvec3 normal(T prim, const glm::dvec3& hitpos) = delete;
+    glm::dvec3 normal(const T& prim, const glm::dvec3& hitpos) = delete;
 
     template <typename T>
     glm::dvec3 normal(T* prim, const glm::dvec3& hitpos) = delete;
 
+    //
+
+    // bounds of the part of the primitive inside the slab [lo, hi] along axis, for spatial
+    // splits. clipping the bounding box is always conservative, primitives that can do better
+    // specialize it
+    template <typename T>
+    BoundingBox clipped_bbox(const T& prim, int axis, double lo, double hi) {
+        auto bounds = bbox(prim);
+
+        bounds.first[axis]  = std::max(bounds.first[axis], lo);
+        bounds.second[axis] = std::min(bounds.second[axis], hi);
+
+        return bounds;
+    }
+
 } // namespace Oxy::Renderer::PrimitiveTraits
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <immintrin.h>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderer/accel/bvh.hpp"
+#include "renderer/utils/ray.hpp"
+#include "renderer/utils/real.hpp"
+
+namespace Oxy::Renderer {
+
+    // primary rays are traced in packets of 4x4 pixels
+    constexpr int ray_packet_tile = 4;
+    constexpr int ray_packet_size = ray_packet_tile * ray_packet_tile;
+
+    static_assert(ray_packet_size <= 32, "active rays are tracked in a 32 bit mask");
+    static_assert(ray_packet_size % 8 == 0, "lanes are tested 8 or 4 at a time");
+
+    // interval bounds of a packet, the box of every ray origin and inverse direction. only
+    // valid when the directions agree in sign on every axis, otherwise the intervals would
+    // span infinity and the packet is traced as single rays
+    template <typename R>
+    struct RayPacketFrustum {
+        Vec3<R> origin_min, origin_max;
+        Vec3<R> inv_dir_min, inv_dir_max;
+
+        int sign[3];
+
+        R tmin, tmax; // loosest interval of the packet, tmax is lowered as rays find hits
+
+        bool valid = false;
+    };
+
+    template <typename R>
+    RayPacketFrustum<R> make_ray_packet_frustum(const RayT<R>* rays, int count) {
+        RayPacketFrustum<R> frustum;
+
+        if (count <= 0)
+            return frustum;
+
+        frustum.origin_min  = frustum.origin_max  = rays[0].origin;
+        frustum.inv_dir_min = frustum.inv_dir_max = rays[0].inv_dir;
+
+        frustum.tmin = rays[0].tmin;
+        frustum.tmax = rays[0].tmax;
+
+        for (int axis = 0; axis < 3; axis++)
+            frustum.sign[axis] = rays[0].sign[axis];
+
+        for (int i = 0; i < count; i++) {
+            const auto& ray = rays[i];
+
+            for (int axis = 0; axis < 3; axis++) {
+                // an axis parallel ray has an infinite inverse, the interval math breaks on it
+                if (ray.sign[axis] != frustum.sign[axis] || !std::isfinite(ray.inv_dir[axis]))
+                    return frustum;
+            }
+
+            frustum.origin_min  = glm::min(frustum.origin_min, ray.origin);
+            frustum.origin_max  = glm::max(frustum.origin_max, ray.origin);
+            frustum.inv_dir_min = glm::min(frustum.inv_dir_min, ray.inv_dir);
+            frustum.inv_dir_max = glm::max(frustum.inv_dir_max, ray.inv_dir);
+
+            frustum.tmin = std::min(frustum.tmin, ray.tmin);
+            frustum.tmax = std::max(frustum.tmax, ray.tmax);
+        }
+
+        frustum.valid = true;
+
+        return frustum;
+    }
+
+    // interval arithmetic culling: the lowest entry and the highest exit distance any ray of
+    // the packet can have per slab are corner products of the bounds. if even those intervals
+    // do not overlap, every ray misses the box and none of them has to be tested
+    template <typename R>
+    inline bool ray_packet_frustum_vs_aabb(const RayPacketFrustum<R>& frustum,
+                                           const Vec3<R>& vmin, const Vec3<R>& vmax) {
+        const Vec3<R>* bounds[2] = {&vmin, &vmax};
+
+        auto t_near = frustum.tmin;
+        auto t_far  = frustum.tmax;
+
+        for (int axis = 0; axis < 3; axis++) {
+            auto near_plane = (*bounds[frustum.sign[axis]])[axis];
+            auto far_plane  = (*bounds[1 - frustum.sign[axis]])[axis];
+
+            // plane - origin over the origin interval, times the inverse direction interval
+            auto d0 = near_plane - frustum.origin_max[axis];
+            auto d1 = near_plane - frustum.origin_min[axis];
+            auto d2 = far_plane - frustum.origin_max[axis];
+            auto d3 = far_plane - frustum.origin_min[axis];
+
+            auto i_min = frustum.inv_dir_min[axis];
+            auto i_max = frustum.inv_dir_max[axis];
+
+            auto t0 = std::min(std::min(d0 * i_min, d0 * i_max), std::min(d1 * i_min, d1 * i_max));
+            auto t1 = std::max(std::max(d2 * i_min, d2 * i_max), std::max(d3 * i_min, d3 * i_max));
+
+            t_near = t0 > t_near ? t0 : t_near;
+            t_far  = t1 < t_far ? t1 : t_far;
+        }
+
+        return t_near <= t_far * ray_box_epsilon<R>;
+    }
+
+    // the rays of a packet in float as structure of arrays, so a box is tested against every
+    // ray of the packet with a few simd instructions. unused lanes are masked off by the caller
+    struct alignas(32) RayPacketLanes {
+        float origin[3][ray_packet_size];
+        float inv_dir[3][ray_packet_size];
+        float tmin[ray_packet_size];
+        float tmax[ray_packet_size];
+    };
+
+    template <typename R>
+    RayPacketLanes make_ray_packet_lanes(const RayT<R>* rays, int count) {
+        RayPacketLanes lanes{};
+
+        for (int i = 0; i < count; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                lanes.origin[axis][i]  = (float)rays[i].origin[axis];
+                lanes.inv_dir[axis][i] = (float)rays[i].inv_dir[axis];
+            }
+
+            lanes.tmin[i] = (float)rays[i].tmin;
+            lanes.tmax[i] = clamp_to_float(rays[i].tmax);
+        }
+
+        return lanes;
+    }
+
+    // slab test of every lane against one box. the rays share their direction signs, so the
+    // near and far planes are the same for all of them. like the wide bvh box tests the far
+    // distance is widened so the float test stays conservative
+    inline uint32_t ray_packet_lanes_vs_aabb(const RayPacketLanes& lanes, const float near[3],
+                                             const float far[3]) {
+        constexpr float epsilon = ray_box_epsilon<float>;
+
+        uint32_t mask = 0;
+
+#if defined(__AVX__)
+        for (int first = 0; first < ray_packet_size; first += 8) {
+            auto t_near = _mm256_load_ps(lanes.tmin + first);
+            auto t_far  = _mm256_load_ps(lanes.tmax + first);
+
+            for (int axis = 0; axis < 3; axis++) {
+                auto origin  = _mm256_load_ps(lanes.origin[axis] + first);
+                auto inv_dir = _mm256_load_ps(lanes.inv_dir[axis] + first);
+
+                auto t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(near[axis]), origin), inv_dir);
+                auto t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(far[axis]), origin), inv_dir);
+
+                // max and min return their second operand for nan, a nan slab is ignored
+                t_near = _mm256_max_ps(t0, t_near);
+                t_far  = _mm256_min_ps(t1, t_far);
+            }
+
+            auto hit = _mm256_cmp_ps(t_near, _mm256_mul_ps(t_far, _mm256_set1_ps(epsilon)),
+                                     _CMP_LE_OQ);
+
+            mask |= (uint32_t)_mm256_movemask_ps(hit) << first;
+        }
+#elif defined(__SSE__)
+        for (int first = 0; first < ray_packet_size; first += 4) {
+            auto t_near = _mm_load_ps(lanes.tmin + first);
+            auto t_far  = _mm_load_ps(lanes.tmax + first);
+
+            for (int axis = 0; axis < 3; axis++) {
+                auto origin  = _mm_load_ps(lanes.origin[axis] + first);
+                auto inv_dir = _mm_load_ps(lanes.inv_dir[axis] + first);
+
+                auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(near[axis]), origin), inv_dir);
+                auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(far[axis]), origin), inv_dir);
+
+                // max and min return their second operand for nan, a nan slab is ignored
+                t_near = _mm_max_ps(t0, t_near);
+                t_far  = _mm_min_ps(t1, t_far);
+            }
+
+            auto hit = _mm_cmple_ps(t_near, _mm_mul_ps(t_far, _mm_set1_ps(epsilon)));
+
+            mask |= (uint32_t)_mm_movemask_ps(hit) << first;
+        }
+#else
+        for (int i = 0; i < ray_packet_size; i++) {
+            auto t_near = lanes.tmin[i];
+            auto t_far  = lanes.tmax[i];
+
+            for (int axis = 0; axis < 3; axis++) {
+                auto t0 = (near[axis] - lanes.origin[axis][i]) * lanes.inv_dir[axis][i];
+                auto t1 = (far[axis] - lanes.origin[axis][i]) * lanes.inv_dir[axis][i];
+
+                t_near = t0 > t_near ? t0 : t_near;
+                t_far  = t1 < t_far ? t1 : t_far;
+            }
+
+            if (t_near <= t_far * epsilon)
+                mask |= 1u << i;
+        }
+#endif
+
+        return mask;
+    }
+
+    // walks the tree with all rays of a packet sharing one stack, every entry carries the mask
+    // of rays still inside it. leaf_fn(mask, primitives_offset, num_primitives) is called once
+    // per leaf for the rays that reached it and shrinks their tmax on hits. a subtree only one
+    // ray reaches is handed to linear_bvh_traverse with single_leaf_fn(ray_index) as its leaf
+    // routine, and packets that do not share direction signs are traced as single rays
+    template <typename R, typename LeafFn, typename SingleLeafFn>
+    void ray_packet_traverse(const std::vector<LinearBVHNode>& nodes, RayT<R>* rays, int count,
+                             LeafFn&& leaf_fn, SingleLeafFn&& single_leaf_fn) {
+        if (nodes.empty() || count <= 0)
+            return;
+
+        auto frustum = make_ray_packet_frustum(rays, count);
+
+        if (!frustum.valid) {
+            for (int i = 0; i < count; i++)
+                linear_bvh_traverse(nodes, rays[i], single_leaf_fn(i));
+
+            return;
+        }
+
+        auto lanes = make_ray_packet_lanes(rays, count);
+
+        // called after leaves, the rays may have found closer hits
+        auto update_tmax = [&]() {
+            frustum.tmax = rays[0].tmax;
+
+            for (int i = 0; i < count; i++) {
+                frustum.tmax  = std::max(frustum.tmax, rays[i].tmax);
+                lanes.tmax[i] = clamp_to_float(rays[i].tmax);
+            }
+        };
+
+        struct StackEntry {
+            uint32_t index;
+            uint32_t mask;
+        };
+
+        StackEntry stack[bvh_stack_size(2)];
+        int        stack_ptr = 0;
+
+        stack[stack_ptr++] = {0, count == 32 ? ~0u : (1u << count) - 1};
+
+        while (stack_ptr != 0) {
+            auto entry = stack[--stack_ptr];
+
+            const auto& node = nodes[entry.index];
+
+            if (!ray_packet_frustum_vs_aabb(frustum, Vec3<R>(node.bbox_min),
+                                            Vec3<R>(node.bbox_max)))
+                continue;
+
+            float near[3], far[3];
+
+            for (int axis = 0; axis < 3; axis++) {
+                near[axis] = frustum.sign[axis] ? node.bbox_max[axis] : node.bbox_min[axis];
+                far[axis]  = frustum.sign[axis] ? node.bbox_min[axis] : node.bbox_max[axis];
+            }
+
+            auto mask = ray_packet_lanes_vs_aabb(lanes, near, far) & entry.mask;
+
+            if (mask == 0)
+                continue;
+
+            // the packet has diverged, one ray is cheaper to finish on its own
+            if ((mask & (mask - 1)) == 0) {
+                auto i = __builtin_ctz(mask);
+
+                linear_bvh_traverse(nodes, rays[i], single_leaf_fn(i), entry.index);
+                update_tmax();
+
+                continue;
+            }
+
+            if (node.is_leaf()) {
+                leaf_fn(mask, node.primitives_offset, node.num_primitives);
+                update_tmax();
+            }
+            else if (frustum.sign[node.axis] != node.upper_first) {
+                stack[stack_ptr++] = {entry.index + 1, mask};
+                stack[stack_ptr++] = {node.second_child_offset, mask};
+            }
+            else {
+                stack[stack_ptr++] = {node.second_child_offset, mask};
+                stack[stack_ptr++] = {entry.index + 1, mask};
+            }
+        }
+    }
+
+} // namespace Oxy::Renderer
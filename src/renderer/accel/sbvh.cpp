@@ -0,0 +1,427 @@
+#include "renderer/accel/bvh.hpp"
+
+namespace Oxy::Renderer {
+
+    // a reference is a BVHBuildPrimitive whose bounds may have been clipped by spatial splits,
+    // its index still points at build_prims
+    using SBVHReferences = std::vector<BVHBuildPrimitive>;
+
+    struct SBVHBuild {
+        const BVHBuildParams& params;
+        const BVHClipFn&      clip;
+
+        double min_overlap; // spatial splits are only searched above this child overlap area
+    };
+
+    struct SBVHSpatialBin {
+        BoundingBox bbox    = empty_bbox();
+        size_t      entries = 0; // references whose bounds start in the bin
+        size_t      exits   = 0; // references whose bounds end in the bin
+    };
+
+    struct SBVHSpatialSplit {
+        double cost  = std::numeric_limits<double>::max();
+        int    axis  = -1;
+        double plane = 0.0;
+
+        // what the split was costed with, counting straddling references on both sides
+        BoundingBox left_bbox   = empty_bbox();
+        BoundingBox right_bbox  = empty_bbox();
+        size_t      left_count  = 0;
+        size_t      right_count = 0;
+    };
+
+    static BoundingBox intersect_bbox(const BoundingBox& a, const BoundingBox& b) {
+        return {glm::max(a.first, b.first), glm::min(a.second, b.second)};
+    }
+
+    static bool is_empty_bbox(const BoundingBox& bbox) {
+        return bbox.first.x > bbox.second.x || bbox.first.y > bbox.second.y ||
+               bbox.first.z > bbox.second.z;
+    }
+
+    // the part of a reference inside [lo, hi] along axis. clipping the primitive again and
+    // keeping the bounds of earlier clips means a reference only ever shrinks
+    static BoundingBox clip_reference(const SBVHBuild& build, const BVHBuildPrimitive& ref,
+                                      int axis, double lo, double hi) {
+        return intersect_bbox(ref.bbox, build.clip(ref.index, axis, lo, hi));
+    }
+
+    static BVHBuildPrimitive make_reference(const BVHBuildPrimitive& ref,
+                                            const BoundingBox& bbox) {
+        return {bbox, 0.5 * (bbox.first + bbox.second), ref.index};
+    }
+
+    // bins the references by their bounds rather than their centroids, a reference spanning
+    // several bins is clipped to each of them. the sweep then costs every plane between bins
+    static SBVHSpatialSplit find_spatial_split(const SBVHBuild& build, const SBVHReferences& refs,
+                                               const BoundingBox& node_bbox, bool parallel) {
+        const auto& params   = build.params;
+        const auto  num_bins = std::max(params.num_bins, 2);
+
+        auto node_area = surface_area(node_bbox);
+        auto inv_area  = node_area > 0.0 ? 1.0 / node_area : 0.0;
+
+        SBVHSpatialSplit best;
+
+        std::vector<double> right_cost(num_bins);
+        std::vector<size_t> right_counts(num_bins);
+
+        for (int axis = 0; axis < 3; axis++) {
+            auto lo     = node_bbox.first[axis];
+            auto extent = node_bbox.second[axis] - lo;
+
+            if (extent <= 0.0)
+                continue;
+
+            auto width = extent / num_bins;
+            auto scale = num_bins / extent;
+
+            auto bin_of = [&](double x) {
+                return std::clamp((int)((x - lo) * scale), 0, num_bins - 1);
+            };
+
+            auto bins = bvh_parallel_reduce(
+                0, refs.size(), parallel, std::vector<SBVHSpatialBin>(num_bins),
+                [&](std::vector<SBVHSpatialBin>& bins, size_t first, size_t last) {
+                    for (auto i = first; i < last; i++) {
+                        const auto& ref = refs[i];
+
+                        auto first_bin = bin_of(ref.bbox.first[axis]);
+                        auto last_bin  = bin_of(ref.bbox.second[axis]);
+
+                        bins[first_bin].entries++;
+                        bins[last_bin].exits++;
+
+                        if (first_bin == last_bin) {
+                            grow_bbox(bins[first_bin].bbox, ref.bbox);
+                            continue;
+                        }
+
+                        for (auto bin = first_bin; bin <= last_bin; bin++) {
+                            auto part = clip_reference(build, ref, axis, lo + bin * width,
+                                                       lo + (bin + 1) * width);
+
+                            if (!is_empty_bbox(part))
+                                grow_bbox(bins[bin].bbox, part);
+                        }
+                    }
+                },
+                [](std::vector<SBVHSpatialBin>& bins, const std::vector<SBVHSpatialBin>& other) {
+                    for (size_t i = 0; i < bins.size(); i++) {
+                        grow_bbox(bins[i].bbox, other[i].bbox);
+                        bins[i].entries += other[i].entries;
+                        bins[i].exits += other[i].exits;
+                    }
+                });
+
+            // same sweeps as the object split, references are counted on the left from the
+            // bin they enter and on the right from the bin they leave
+            auto   right_bbox  = empty_bbox();
+            size_t right_count = 0;
+
+            for (int split = num_bins - 1; split > 0; split--) {
+                grow_bbox(right_bbox, bins[split].bbox);
+                right_count += bins[split].exits;
+
+                right_cost[split - 1] =
+                    surface_area(right_bbox) * bvh_leaf_tests(right_count, params);
+                right_counts[split - 1] = right_count;
+            }
+
+            auto   left_bbox  = empty_bbox();
+            size_t left_count = 0;
+            int    best_split = -1;
+
+            for (int split = 0; split < num_bins - 1; split++) {
+                grow_bbox(left_bbox, bins[split].bbox);
+                left_count += bins[split].entries;
+
+                if (left_count == 0 || right_counts[split] == 0)
+                    continue;
+
+                auto cost = params.traversal_cost +
+                            params.intersection_cost * inv_area *
+                                (surface_area(left_bbox) * bvh_leaf_tests(left_count, params) +
+                                 right_cost[split]);
+
+                if (cost < best.cost) {
+                    best.cost  = cost;
+                    best.axis  = axis;
+                    best.plane = lo + (split + 1) * width;
+                    best_split = split;
+                }
+            }
+
+            if (best_split == -1)
+                continue;
+
+            best.left_bbox   = empty_bbox();
+            best.right_bbox  = empty_bbox();
+            best.left_count  = 0;
+            best.right_count = 0;
+
+            for (int bin = 0; bin < num_bins; bin++) {
+                if (bin <= best_split) {
+                    grow_bbox(best.left_bbox, bins[bin].bbox);
+                    best.left_count += bins[bin].entries;
+                }
+                else {
+                    grow_bbox(best.right_bbox, bins[bin].bbox);
+                    best.right_count += bins[bin].exits;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    // sorts the references to the sides of the plane. a straddling reference is split in two
+    // while the budget lasts, unless keeping it whole on one side is cheaper (stich et al.,
+    // "spatial splits in bounding volume hierarchies")
+    static void partition_spatial_split(const SBVHBuild& build, const SBVHReferences& refs,
+                                        const SBVHSpatialSplit& split, int64_t& budget,
+                                        SBVHReferences& left, SBVHReferences& right) {
+        const auto axis  = split.axis;
+        const auto plane = split.plane;
+
+        auto left_bbox  = split.left_bbox;
+        auto right_bbox = split.right_bbox;
+
+        auto left_count  = (double)split.left_count;
+        auto right_count = (double)split.right_count;
+
+        for (const auto& ref : refs) {
+            if (ref.bbox.second[axis] <= plane) {
+                left.push_back(ref);
+                continue;
+            }
+
+            if (ref.bbox.first[axis] >= plane) {
+                right.push_back(ref);
+                continue;
+            }
+
+            auto left_part  = clip_reference(build, ref, axis, ref.bbox.first[axis], plane);
+            auto right_part = clip_reference(build, ref, axis, plane, ref.bbox.second[axis]);
+
+            // the bounds cross the plane but the primitive itself does not
+            if (is_empty_bbox(left_part) || is_empty_bbox(right_part)) {
+                (is_empty_bbox(left_part) ? right : left).push_back(ref);
+                continue;
+            }
+
+            auto left_area  = surface_area(left_bbox);
+            auto right_area = surface_area(right_bbox);
+
+            auto left_grown = left_bbox, right_grown = right_bbox;
+            grow_bbox(left_grown, ref.bbox);
+            grow_bbox(right_grown, ref.bbox);
+
+            auto split_cost = left_area * left_count + right_area * right_count;
+            auto keep_left =
+                surface_area(left_grown) * left_count + right_area * (right_count - 1);
+            auto keep_right =
+                left_area * (left_count - 1) + surface_area(right_grown) * right_count;
+
+            if (split_cost < std::min(keep_left, keep_right) && budget > 0) {
+                budget--;
+
+                left.push_back(make_reference(ref, left_part));
+                right.push_back(make_reference(ref, right_part));
+            }
+            else if (keep_left <= keep_right) {
+                left.push_back(ref);
+                left_bbox = left_grown;
+                right_count--;
+            }
+            else {
+                right.push_back(ref);
+                right_bbox = right_grown;
+                left_count--;
+            }
+        }
+    }
+
+    static uint32_t build_sbvh_node(const SBVHBuild& build, SBVHReferences& refs, int64_t budget,
+                                    std::vector<LinearBVHNode>& nodes,
+                                    std::vector<size_t>& references, int depth);
+
+    // builds both children of an inner node, big ones build the second child on the pool. the
+    // budget left is shared by reference count, so the tree does not depend on which thread
+    // gets to a straddling reference first
+    static void build_sbvh_children(const SBVHBuild& build, SBVHReferences& left,
+                                    SBVHReferences& right, int64_t budget,
+                                    std::vector<LinearBVHNode>& nodes,
+                                    std::vector<size_t>& references, uint32_t node_index,
+                                    int depth) {
+
+        auto left_budget  = budget * (int64_t)left.size() / (int64_t)(left.size() + right.size());
+        auto right_budget = budget - left_budget;
+
+        if (left.size() + right.size() <= build.params.parallel_threshold) {
+            build_sbvh_node(build, left, left_budget, nodes, references, depth + 1);
+
+            auto second_child =
+                build_sbvh_node(build, right, right_budget, nodes, references, depth + 1);
+            nodes[node_index].second_child_offset = second_child;
+
+            return;
+        }
+
+        std::vector<LinearBVHNode> second_nodes;
+        std::vector<size_t>        second_references;
+
+        TaskGroup tasks;
+        tasks.run([&] {
+            build_sbvh_node(build, right, right_budget, second_nodes, second_references,
+                            depth + 1);
+        });
+
+        build_sbvh_node(build, left, left_budget, nodes, references, depth + 1);
+
+        tasks.wait();
+
+        // the leaves of the second subtree index its own reference list, rebased like the
+        // inner node offsets
+        for (auto& node : second_nodes)
+            if (node.is_leaf())
+                node.primitives_offset += (uint32_t)references.size();
+
+        references.insert(references.end(), second_references.begin(), second_references.end());
+
+        nodes[node_index].second_child_offset = append_bvh_subtree(nodes, second_nodes);
+    }
+
+    // the references of a node are released before its children are built
+    static uint32_t build_sbvh_node(const SBVHBuild& build, SBVHReferences& refs, int64_t budget,
+                                    std::vector<LinearBVHNode>& nodes,
+                                    std::vector<size_t>& references, int depth) {
+
+        const auto& params = build.params;
+
+        auto node_index = (uint32_t)nodes.size();
+        nodes.emplace_back();
+
+        const auto count    = refs.size();
+        const bool parallel = count > params.parallel_threshold;
+
+        auto [node_bbox, centroid_bbox] = bvh_range_bounds(refs, 0, count, parallel);
+
+        nodes[node_index].set_bbox(node_bbox);
+
+        auto make_leaf = [&]() {
+            nodes[node_index].primitives_offset = (uint32_t)references.size();
+            nodes[node_index].num_primitives    = (uint16_t)count;
+
+            for (const auto& ref : refs)
+                references.push_back(ref.index);
+
+            SBVHReferences().swap(refs);
+
+            return node_index;
+        };
+
+        if (count <= 1)
+            return make_leaf();
+
+        SBVHReferences left, right;
+
+        auto split_at = [&](size_t middle) {
+            left.assign(refs.begin(), refs.begin() + middle);
+            right.assign(refs.begin() + middle, refs.end());
+        };
+
+        if (depth >= bvh_median_split_depth) {
+            // the rest of the tree has to be balanced to stay within bvh_max_depth, no more
+            // references are added this deep
+            if (count <= params.max_leaf_size)
+                return make_leaf();
+
+            auto [middle, axis] = bvh_median_split(refs, 0, count, centroid_bbox);
+
+            nodes[node_index].axis = axis;
+            split_at(middle);
+        }
+        else {
+            auto object = bvh_find_object_split(refs, 0, count, node_bbox, centroid_bbox, params,
+                                                parallel);
+
+            // spatial splits only pay off where the object split leaves the children
+            // overlapping, or cannot separate the references at all. they are searched even
+            // with the budget spent, straddling references are then kept whole on one side
+            SBVHSpatialSplit spatial;
+
+            auto overlap = surface_area(intersect_bbox(object.left_bbox, object.right_bbox));
+
+            if (object.axis == -1 || overlap > build.min_overlap)
+                spatial = find_spatial_split(build, refs, node_bbox, parallel);
+
+            auto leaf_cost = params.intersection_cost * bvh_leaf_tests(count, params);
+            auto best_cost = std::min(object.cost, spatial.cost);
+
+            if (count <= params.max_leaf_size &&
+                ((object.axis == -1 && spatial.axis == -1) || leaf_cost <= best_cost))
+                return make_leaf();
+
+            if (spatial.axis != -1 && spatial.cost < object.cost) {
+                partition_spatial_split(build, refs, spatial, budget, left, right);
+                nodes[node_index].axis = spatial.axis;
+            }
+
+            // falls back to the object split when every straddling reference went to one side
+            if (left.empty() || right.empty()) {
+                left.clear();
+                right.clear();
+
+                auto middle = count / 2;
+
+                if (object.axis != -1)
+                    middle = bvh_partition_object_split(refs, 0, count, object, centroid_bbox);
+
+                // all centroids coincide, split by count instead
+                if (middle == 0 || middle == count)
+                    middle = count / 2;
+
+                nodes[node_index].axis = object.axis == -1 ? 0 : object.axis;
+                split_at(middle);
+            }
+        }
+
+        SBVHReferences().swap(refs);
+
+        build_sbvh_children(build, left, right, budget, nodes, references, node_index, depth);
+
+        return node_index;
+    }
+
+    std::vector<size_t> build_bvh_sbvh(const std::vector<BVHBuildPrimitive>& build_prims,
+                                       size_t left_index, size_t right_index,
+                                       const BVHBuildParams& params, const BVHClipFn& clip,
+                                       std::vector<LinearBVHNode>& nodes) {
+
+        const auto count    = right_index - left_index;
+        const bool parallel = count > params.parallel_threshold;
+
+        auto root_bbox = bvh_range_bounds(build_prims, left_index, right_index, parallel).first;
+        auto budget    = (int64_t)(params.spatial_split_budget * count);
+
+        SBVHBuild build{params, clip, params.spatial_split_alpha * surface_area(root_bbox)};
+
+        SBVHReferences refs(build_prims.begin() + left_index, build_prims.begin() + right_index);
+
+        std::vector<size_t> references;
+        references.reserve(count + std::max<int64_t>(budget, 0));
+
+        auto root = (uint32_t)nodes.size();
+
+        build_sbvh_node(build, refs, budget, nodes, references, 0);
+
+        for (auto it = nodes.begin() + root; it != nodes.end(); it++)
+            if (it->is_leaf())
+                it->primitives_offset += (uint32_t)left_index;
+
+        return references;
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderer/accel/bvh.hpp"
+#include "renderer/accel/primitive.hpp"
+#include "renderer/accel/triangle_block.hpp"
+#include "renderer/utils/ray.hpp"
+
+namespace Oxy::Renderer {
+
+    constexpr int sphere_block_width = triangle_block_width;
+
+    // N analytic spheres of a leaf as structure of arrays in float, 16 bytes per sphere.
+    // padding lanes have a nan center so every compare of the kernel fails on them
+    template <int N>
+    struct alignas(N * sizeof(float)) SphereBlock {
+        float center[3][N];
+        float radius[N];
+
+        glm::dvec3 normal(int lane, const glm::dvec3& hitpos) const {
+            glm::dvec3 c(center[0][lane], center[1][lane], center[2][lane]);
+            return (hitpos - c) / (double)radius[lane];
+        }
+    };
+
+    static_assert(sizeof(SphereBlock<sphere_block_width>) == 16 * sphere_block_width);
+
+    // same block and lane pair as for triangles
+    using SphereBlockHit = TriangleBlockHit;
+
+    template <int N>
+    SphereBlock<N> make_sphere_block(const std::vector<Sphere>& spheres, size_t first,
+                                     size_t count) {
+        SphereBlock<N> block{};
+
+        for (int lane = 0; lane < N; lane++) {
+            if ((size_t)lane >= count) {
+                for (int axis = 0; axis < 3; axis++)
+                    block.center[axis][lane] = std::numeric_limits<float>::quiet_NaN();
+
+                continue;
+            }
+
+            const auto& sphere = spheres[first + lane];
+
+            for (int axis = 0; axis < 3; axis++)
+                block.center[axis][lane] = (float)sphere.center()[axis];
+
+            block.radius[lane] = (float)sphere.radius();
+        }
+
+        return block;
+    }
+
+    // packs the spheres of every leaf into blocks and points the leaves at their first block,
+    // like pack_triangle_blocks
+    template <int N>
+    std::vector<SphereBlock<N>> pack_sphere_blocks(std::vector<LinearBVHNode>& nodes,
+                                                   const std::vector<Sphere>&  spheres) {
+        std::vector<SphereBlock<N>> blocks;
+
+        for (auto& node : nodes) {
+            if (!node.is_leaf())
+                continue;
+
+            auto first_block = (uint32_t)blocks.size();
+
+            for (size_t i = 0; i < node.num_primitives; i += N) {
+                auto first = node.primitives_offset + i;
+                auto count = std::min<size_t>(N, node.num_primitives - i);
+
+                blocks.push_back(make_sphere_block<N>(spheres, first, count));
+            }
+
+            node.primitives_offset = first_block;
+        }
+
+        return blocks;
+    }
+
+    // the ray with the squared length of its direction, which every lane shares
+    struct SphereBlockRay {
+        template <typename R>
+        SphereBlockRay(const RayT<R>& ray) {
+            for (int axis = 0; axis < 3; axis++) {
+                origin[axis] = (float)ray.origin[axis];
+                dir[axis]    = (float)ray.dir[axis];
+            }
+
+            dir_len2     = dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2];
+            inv_dir_len2 = 1.0f / dir_len2;
+        }
+
+        float origin[3];
+        float dir[3];
+        float dir_len2, inv_dir_len2;
+    };
+
+    // the discriminant is taken from the distance between the center and the closest point of
+    // the ray instead of b * b - 4 * a * c, which loses everything to cancellation in float
+    // once the sphere is small against its distance. returns the nearest root inside
+    // [tmin, tmax), the far one when the ray starts inside the sphere
+    template <int N>
+    inline bool intersect_sphere_block(const SphereBlock<N>& block, const SphereBlockRay& ray,
+                                       float tmin, float tmax, float& t, int& lane) {
+        bool hit = false;
+
+        for (int i = 0; i < N; i++) {
+            float oc[3] = {ray.origin[0] - block.center[0][i], ray.origin[1] - block.center[1][i],
+                           ray.origin[2] - block.center[2][i]};
+
+            auto b  = -(oc[0] * ray.dir[0] + oc[1] * ray.dir[1] + oc[2] * ray.dir[2]);
+            auto tc = b * ray.inv_dir_len2;
+
+            float l[3] = {oc[0] + tc * ray.dir[0], oc[1] + tc * ray.dir[1],
+                          oc[2] + tc * ray.dir[2]};
+
+            auto r    = block.radius[i];
+            auto disc = r * r - (l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+
+            if (!(disc >= 0.0f))
+                continue;
+
+            auto s = std::sqrt(ray.dir_len2 * disc);
+
+            auto t_near = (b - s) * ray.inv_dir_len2;
+            auto t_far  = (b + s) * ray.inv_dir_len2;
+
+            auto hit_t = t_near >= tmin ? t_near : t_far;
+
+            if (hit_t >= tmin && hit_t < tmax) {
+                tmax = hit_t;
+                t    = hit_t;
+                lane = i;
+                hit  = true;
+            }
+        }
+
+        return hit;
+    }
+
+#ifdef __SSE__
+    template <>
+    inline bool intersect_sphere_block<4>(const SphereBlock<4>& block, const SphereBlockRay& ray,
+                                          float tmin, float tmax, float& t, int& lane) {
+        auto dx = _mm_set1_ps(ray.dir[0]);
+        auto dy = _mm_set1_ps(ray.dir[1]);
+        auto dz = _mm_set1_ps(ray.dir[2]);
+
+        auto ox = _mm_sub_ps(_mm_set1_ps(ray.origin[0]), _mm_load_ps(block.center[0]));
+        auto oy = _mm_sub_ps(_mm_set1_ps(ray.origin[1]), _mm_load_ps(block.center[1]));
+        auto oz = _mm_sub_ps(_mm_set1_ps(ray.origin[2]), _mm_load_ps(block.center[2]));
+
+        auto inv_a = _mm_set1_ps(ray.inv_dir_len2);
+
+        // b = -dot(oc, dir), the closest point of the ray is at b / a
+        auto b  = _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, dx),
+                                                                    _mm_mul_ps(oy, dy)),
+                                                         _mm_mul_ps(oz, dz)));
+        auto tc = _mm_mul_ps(b, inv_a);
+
+        auto lx = _mm_add_ps(ox, _mm_mul_ps(tc, dx));
+        auto ly = _mm_add_ps(oy, _mm_mul_ps(tc, dy));
+        auto lz = _mm_add_ps(oz, _mm_mul_ps(tc, dz));
+
+        auto radius = _mm_load_ps(block.radius);
+        auto disc   = _mm_sub_ps(_mm_mul_ps(radius, radius),
+                                 _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)),
+                                            _mm_mul_ps(lz, lz)));
+
+        auto s = _mm_sqrt_ps(_mm_mul_ps(_mm_set1_ps(ray.dir_len2), disc));
+
+        auto t_near = _mm_mul_ps(_mm_sub_ps(b, s), inv_a);
+        auto t_far  = _mm_mul_ps(_mm_add_ps(b, s), inv_a);
+
+        // the near root unless it lies behind tmin, then the far one. every compare is false
+        // for nan, which covers negative discriminants and the padding lanes
+        auto vtmin = _mm_set1_ps(tmin);
+        auto near  = _mm_cmpge_ps(t_near, vtmin);
+        auto hit_t = _mm_or_ps(_mm_and_ps(near, t_near), _mm_andnot_ps(near, t_far));
+
+        auto mask = _mm_and_ps(_mm_cmpge_ps(disc, _mm_setzero_ps()), _mm_cmpge_ps(hit_t, vtmin));
+        mask      = _mm_and_ps(mask, _mm_cmplt_ps(hit_t, _mm_set1_ps(tmax)));
+
+        if (_mm_movemask_ps(mask) == 0)
+            return false;
+
+        // nearest lane, misses are pushed to infinity before the horizontal min
+        auto inf    = _mm_set1_ps(std::numeric_limits<float>::infinity());
+        auto masked = _mm_or_ps(_mm_and_ps(mask, hit_t), _mm_andnot_ps(mask, inf));
+
+        auto min = _mm_min_ps(masked, _mm_shuffle_ps(masked, masked, _MM_SHUFFLE(2, 3, 0, 1)));
+        min      = _mm_min_ps(min, _mm_shuffle_ps(min, min, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        lane = __builtin_ctz(_mm_movemask_ps(_mm_and_ps(mask, _mm_cmpeq_ps(masked, min))));
+        t    = _mm_cvtss_f32(min);
+
+        return true;
+    }
+#endif
+
+#ifdef __AVX__
+    template <>
+    inline bool intersect_sphere_block<8>(const SphereBlock<8>& block, const SphereBlockRay& ray,
+                                          float tmin, float tmax, float& t, int& lane) {
+        auto dx = _mm256_set1_ps(ray.dir[0]);
+        auto dy = _mm256_set1_ps(ray.dir[1]);
+        auto dz = _mm256_set1_ps(ray.dir[2]);
+
+        auto ox = _mm256_sub_ps(_mm256_set1_ps(ray.origin[0]), _mm256_load_ps(block.center[0]));
+        auto oy = _mm256_sub_ps(_mm256_set1_ps(ray.origin[1]), _mm256_load_ps(block.center[1]));
+        auto oz = _mm256_sub_ps(_mm256_set1_ps(ray.origin[2]), _mm256_load_ps(block.center[2]));
+
+        auto inv_a = _mm256_set1_ps(ray.inv_dir_len2);
+
+        // b = -dot(oc, dir), the closest point of the ray is at b / a
+        auto b  = _mm256_sub_ps(_mm256_setzero_ps(),
+                                _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ox, dx),
+                                                            _mm256_mul_ps(oy, dy)),
+                                              _mm256_mul_ps(oz, dz)));
+        auto tc = _mm256_mul_ps(b, inv_a);
+
+        auto lx = _mm256_add_ps(ox, _mm256_mul_ps(tc, dx));
+        auto ly = _mm256_add_ps(oy, _mm256_mul_ps(tc, dy));
+        auto lz = _mm256_add_ps(oz, _mm256_mul_ps(tc, dz));
+
+        auto radius = _mm256_load_ps(block.radius);
+        auto disc   = _mm256_sub_ps(_mm256_mul_ps(radius, radius),
+                                    _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx),
+                                                                _mm256_mul_ps(ly, ly)),
+                                                  _mm256_mul_ps(lz, lz)));
+
+        auto s = _mm256_sqrt_ps(_mm256_mul_ps(_mm256_set1_ps(ray.dir_len2), disc));
+
+        auto t_near = _mm256_mul_ps(_mm256_sub_ps(b, s), inv_a);
+        auto t_far  = _mm256_mul_ps(_mm256_add_ps(b, s), inv_a);
+
+        // the near root unless it lies behind tmin, then the far one. ordered compares are
+        // false for nan, which covers negative discriminants and the padding lanes
+        auto vtmin = _mm256_set1_ps(tmin);
+        auto hit_t = _mm256_blendv_ps(t_far, t_near, _mm256_cmp_ps(t_near, vtmin, _CMP_GE_OQ));
+
+        auto mask = _mm256_and_ps(_mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GE_OQ),
+                                  _mm256_cmp_ps(hit_t, vtmin, _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(hit_t, _mm256_set1_ps(tmax), _CMP_LT_OQ));
+
+        if (_mm256_movemask_ps(mask) == 0)
+            return false;
+
+        // nearest lane, misses are pushed to infinity before the horizontal min
+        auto inf    = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+        auto masked = _mm256_blendv_ps(inf, hit_t, mask);
+
+        auto min = _mm256_min_ps(masked, _mm256_permute_ps(masked, _MM_SHUFFLE(2, 3, 0, 1)));
+        min      = _mm256_min_ps(min, _mm256_permute_ps(min, _MM_SHUFFLE(1, 0, 3, 2)));
+        min      = _mm256_min_ps(min, _mm256_permute2f128_ps(min, min, 0x01));
+
+        lane = __builtin_ctz(
+            _mm256_movemask_ps(_mm256_and_ps(mask, _mm256_cmp_ps(masked, min, _CMP_EQ_OQ))));
+        t = _mm256_cvtss_f32(min);
+
+        return true;
+    }
+#endif
+
+    // leaf routines for trees whose leaves point at sphere blocks, count is the number of
+    // spheres in the leaf
+    template <int N, typename R>
+    auto closest_hit_leaf_spheres(const std::vector<SphereBlock<N>>& blocks, RayT<R>& ray,
+                                  SphereBlockHit& hit) {
+        return [&](uint32_t offset, uint16_t count) {
+            SphereBlockRay block_ray(ray);
+
+            auto tmin = (float)ray.tmin;
+            auto tmax = clamp_to_float(ray.tmax);
+
+            for (auto it = blocks.begin() + offset; count > 0; it++) {
+                float t;
+                int   lane;
+
+                if (intersect_sphere_block<N>(*it, block_ray, tmin, tmax, t, lane)) {
+                    tmax      = t;
+                    ray.tmax  = t;
+                    hit.block = (uint32_t)(it - blocks.begin());
+                    hit.lane  = lane;
+                }
+
+                count -= std::min<uint16_t>(count, N);
+            }
+
+            return false;
+        };
+    }
+
+    template <int N, typename R>
+    auto any_hit_leaf_spheres(const std::vector<SphereBlock<N>>& blocks, const RayT<R>& ray) {
+        return [&](uint32_t offset, uint16_t count) {
+            SphereBlockRay block_ray(ray);
+
+            auto tmin = (float)ray.tmin;
+            auto tmax = clamp_to_float(ray.tmax);
+
+            for (auto it = blocks.begin() + offset; count > 0; it++) {
+                float t;
+                int   lane;
+
+                if (intersect_sphere_block<N>(*it, block_ray, tmin, tmax, t, lane))
+                    return true;
+
+                count -= std::min<uint16_t>(count, N);
+            }
+
+            return false;
+        };
+    }
+
+} // namespace Oxy::Renderer
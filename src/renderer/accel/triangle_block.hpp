@@ -0,0 +1,367 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderer/accel/bvh.hpp"
+#include "renderer/accel/primitive.hpp"
+#include "renderer/utils/ray.hpp"
+
+namespace Oxy::Renderer {
+
+#if defined(__AVX__)
+    constexpr int triangle_block_width = 8;
+#else
+    constexpr int triangle_block_width = 4;
+#endif
+
+    // N triangles of a leaf repacked as structure of arrays in float, with the edge vectors
+    // precomputed so a single simd kernel can test one ray against all of them. this is the
+    // only triangle data a mesh keeps after setup, 36 bytes per triangle
+    template <int N>
+    struct alignas(N * sizeof(float)) TriangleBlock {
+        float v0[3][N];
+        float edge1[3][N];
+        float edge2[3][N];
+
+        glm::dvec3 normal(int lane) const {
+            glm::dvec3 e1(edge1[0][lane], edge1[1][lane], edge1[2][lane]);
+            glm::dvec3 e2(edge2[0][lane], edge2[1][lane], edge2[2][lane]);
+
+            return glm::normalize(glm::cross(e1, e2));
+        }
+    };
+
+    static_assert(sizeof(TriangleBlock<triangle_block_width>) == 36 * triangle_block_width);
+
+    // where a closest hit query ended up, block is no_block if nothing was hit
+    struct TriangleBlockHit {
+        static constexpr uint32_t no_block = std::numeric_limits<uint32_t>::max();
+
+        uint32_t block = no_block;
+        int      lane  = 0;
+
+        bool hit() const { return block != no_block; }
+    };
+
+    struct TriangleBlockRay {
+        template <typename R>
+        TriangleBlockRay(const RayT<R>& ray) {
+            for (int axis = 0; axis < 3; axis++) {
+                origin[axis] = (float)ray.origin[axis];
+                dir[axis]    = (float)ray.dir[axis];
+            }
+        }
+
+        float origin[3];
+        float dir[3];
+    };
+
+    template <int N>
+    TriangleBlock<N> make_triangle_block(const std::vector<Triangle>& triangles, size_t first,
+                                         size_t count) {
+        TriangleBlock<N> block{};
+
+        for (int lane = 0; lane < N; lane++) {
+            // padding lanes are left degenerate, their determinant is zero so they never hit
+            if ((size_t)lane >= count)
+                continue;
+
+            const auto& tri = triangles[first + lane];
+
+            auto edge1 = tri.p1() - tri.p0();
+            auto edge2 = tri.p2() - tri.p0();
+
+            for (int axis = 0; axis < 3; axis++) {
+                block.v0[axis][lane]    = (float)tri.p0()[axis];
+                block.edge1[axis][lane] = (float)edge1[axis];
+                block.edge2[axis][lane] = (float)edge2[axis];
+            }
+        }
+
+        return block;
+    }
+
+    // packs the triangles of every leaf into blocks and points the leaves at their first block,
+    // a leaf with n triangles uses (n + N - 1) / N consecutive blocks
+    template <int N>
+    std::vector<TriangleBlock<N>> pack_triangle_blocks(std::vector<LinearBVHNode>&  nodes,
+                                                       const std::vector<Triangle>& triangles) {
+        std::vector<TriangleBlock<N>> blocks;
+
+        for (auto& node : nodes) {
+            if (!node.is_leaf())
+                continue;
+
+            auto first_block = (uint32_t)blocks.size();
+
+            for (size_t i = 0; i < node.num_primitives; i += N) {
+                auto first = node.primitives_offset + i;
+                auto count = std::min<size_t>(N, node.num_primitives - i);
+
+                blocks.push_back(make_triangle_block<N>(triangles, first, count));
+            }
+
+            node.primitives_offset = first_block;
+        }
+
+        return blocks;
+    }
+
+    // moller-trumbore against every lane, returns the nearest hit inside [tmin, tmax)
+    template <int N>
+    inline bool intersect_triangle_block(const TriangleBlock<N>& block, const TriangleBlockRay& ray,
+                                         float tmin, float tmax, float& t, int& lane) {
+        bool hit = false;
+
+        for (int i = 0; i < N; i++) {
+            float e1[3] = {block.edge1[0][i], block.edge1[1][i], block.edge1[2][i]};
+            float e2[3] = {block.edge2[0][i], block.edge2[1][i], block.edge2[2][i]};
+
+            float pvec[3] = {ray.dir[1] * e2[2] - ray.dir[2] * e2[1],
+                             ray.dir[2] * e2[0] - ray.dir[0] * e2[2],
+                             ray.dir[0] * e2[1] - ray.dir[1] * e2[0]};
+
+            auto det = e1[0] * pvec[0] + e1[1] * pvec[1] + e1[2] * pvec[2];
+
+            if (det == 0.0f)
+                continue;
+
+            auto inv_det = 1.0f / det;
+
+            float tvec[3] = {ray.origin[0] - block.v0[0][i], ray.origin[1] - block.v0[1][i],
+                             ray.origin[2] - block.v0[2][i]};
+
+            float qvec[3] = {tvec[1] * e1[2] - tvec[2] * e1[1], tvec[2] * e1[0] - tvec[0] * e1[2],
+                             tvec[0] * e1[1] - tvec[1] * e1[0]};
+
+            auto u = (tvec[0] * pvec[0] + tvec[1] * pvec[1] + tvec[2] * pvec[2]) * inv_det;
+            auto v = (ray.dir[0] * qvec[0] + ray.dir[1] * qvec[1] + ray.dir[2] * qvec[2]) * inv_det;
+
+            if ((u < 0) | (v < 0) | (u + v > 1))
+                continue;
+
+            auto hit_t = (e2[0] * qvec[0] + e2[1] * qvec[1] + e2[2] * qvec[2]) * inv_det;
+
+            if (hit_t >= tmin && hit_t < tmax) {
+                tmax = hit_t;
+                t    = hit_t;
+                lane = i;
+                hit  = true;
+            }
+        }
+
+        return hit;
+    }
+
+#ifdef __SSE__
+    template <>
+    inline bool intersect_triangle_block<4>(const TriangleBlock<4>& block,
+                                            const TriangleBlockRay& ray, float tmin, float tmax,
+                                            float& t, int& lane) {
+        auto dx = _mm_set1_ps(ray.dir[0]);
+        auto dy = _mm_set1_ps(ray.dir[1]);
+        auto dz = _mm_set1_ps(ray.dir[2]);
+
+        auto e1x = _mm_load_ps(block.edge1[0]);
+        auto e1y = _mm_load_ps(block.edge1[1]);
+        auto e1z = _mm_load_ps(block.edge1[2]);
+
+        auto e2x = _mm_load_ps(block.edge2[0]);
+        auto e2y = _mm_load_ps(block.edge2[1]);
+        auto e2z = _mm_load_ps(block.edge2[2]);
+
+        // pvec = cross(dir, edge2)
+        auto px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        auto py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        auto pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+        auto det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+                              _mm_mul_ps(e1z, pz));
+
+        auto inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+        auto tx = _mm_sub_ps(_mm_set1_ps(ray.origin[0]), _mm_load_ps(block.v0[0]));
+        auto ty = _mm_sub_ps(_mm_set1_ps(ray.origin[1]), _mm_load_ps(block.v0[1]));
+        auto tz = _mm_sub_ps(_mm_set1_ps(ray.origin[2]), _mm_load_ps(block.v0[2]));
+
+        // qvec = cross(tvec, edge1)
+        auto qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        auto qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        auto qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+        auto u = _mm_mul_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)),
+            inv_det);
+
+        auto v = _mm_mul_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)),
+            inv_det);
+
+        auto hit_t = _mm_mul_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)),
+            inv_det);
+
+        auto zero = _mm_setzero_ps();
+
+        // every compare is false for nan, which covers the lanes with a zero determinant
+        auto mask = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+        mask      = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        mask      = _mm_and_ps(mask, _mm_cmpge_ps(hit_t, _mm_set1_ps(tmin)));
+        mask      = _mm_and_ps(mask, _mm_cmplt_ps(hit_t, _mm_set1_ps(tmax)));
+        mask      = _mm_and_ps(mask, _mm_cmpneq_ps(det, zero));
+
+        if (_mm_movemask_ps(mask) == 0)
+            return false;
+
+        // nearest lane, misses are pushed to infinity before the horizontal min
+        auto inf    = _mm_set1_ps(std::numeric_limits<float>::infinity());
+        auto masked = _mm_or_ps(_mm_and_ps(mask, hit_t), _mm_andnot_ps(mask, inf));
+
+        auto min = _mm_min_ps(masked, _mm_shuffle_ps(masked, masked, _MM_SHUFFLE(2, 3, 0, 1)));
+        min      = _mm_min_ps(min, _mm_shuffle_ps(min, min, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        lane = __builtin_ctz(_mm_movemask_ps(_mm_and_ps(mask, _mm_cmpeq_ps(masked, min))));
+        t    = _mm_cvtss_f32(min);
+
+        return true;
+    }
+#endif
+
+#ifdef __AVX__
+    template <>
+    inline bool intersect_triangle_block<8>(const TriangleBlock<8>& block,
+                                            const TriangleBlockRay& ray, float tmin, float tmax,
+                                            float& t, int& lane) {
+        auto dx = _mm256_set1_ps(ray.dir[0]);
+        auto dy = _mm256_set1_ps(ray.dir[1]);
+        auto dz = _mm256_set1_ps(ray.dir[2]);
+
+        auto e1x = _mm256_load_ps(block.edge1[0]);
+        auto e1y = _mm256_load_ps(block.edge1[1]);
+        auto e1z = _mm256_load_ps(block.edge1[2]);
+
+        auto e2x = _mm256_load_ps(block.edge2[0]);
+        auto e2y = _mm256_load_ps(block.edge2[1]);
+        auto e2z = _mm256_load_ps(block.edge2[2]);
+
+        // pvec = cross(dir, edge2)
+        auto px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        auto py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        auto pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+        auto det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)),
+                                 _mm256_mul_ps(e1z, pz));
+
+        auto inv_det = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+        auto tx = _mm256_sub_ps(_mm256_set1_ps(ray.origin[0]), _mm256_load_ps(block.v0[0]));
+        auto ty = _mm256_sub_ps(_mm256_set1_ps(ray.origin[1]), _mm256_load_ps(block.v0[1]));
+        auto tz = _mm256_sub_ps(_mm256_set1_ps(ray.origin[2]), _mm256_load_ps(block.v0[2]));
+
+        // qvec = cross(tvec, edge1)
+        auto qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+        auto qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+        auto qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+
+        auto u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px),
+                                                           _mm256_mul_ps(ty, py)),
+                                             _mm256_mul_ps(tz, pz)),
+                               inv_det);
+
+        auto v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx),
+                                                           _mm256_mul_ps(dy, qy)),
+                                             _mm256_mul_ps(dz, qz)),
+                               inv_det);
+
+        auto hit_t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx),
+                                                               _mm256_mul_ps(e2y, qy)),
+                                                 _mm256_mul_ps(e2z, qz)),
+                                   inv_det);
+
+        auto zero = _mm256_setzero_ps();
+
+        // ordered compares are false for nan, which covers the lanes with a zero determinant
+        auto mask = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ),
+                                  _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        mask      = _mm256_and_ps(
+            mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(hit_t, _mm256_set1_ps(tmin), _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(hit_t, _mm256_set1_ps(tmax), _CMP_LT_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+
+        if (_mm256_movemask_ps(mask) == 0)
+            return false;
+
+        // nearest lane, misses are pushed to infinity before the horizontal min
+        auto inf    = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+        auto masked = _mm256_blendv_ps(inf, hit_t, mask);
+
+        auto min = _mm256_min_ps(masked, _mm256_permute_ps(masked, _MM_SHUFFLE(2, 3, 0, 1)));
+        min      = _mm256_min_ps(min, _mm256_permute_ps(min, _MM_SHUFFLE(1, 0, 3, 2)));
+        min      = _mm256_min_ps(min, _mm256_permute2f128_ps(min, min, 0x01));
+
+        lane = __builtin_ctz(
+            _mm256_movemask_ps(_mm256_and_ps(mask, _mm256_cmp_ps(masked, min, _CMP_EQ_OQ))));
+        t = _mm256_cvtss_f32(min);
+
+        return true;
+    }
+#endif
+
+    // leaf routines for meshes whose leaves point at triangle blocks, count is the number of
+    // triangles in the leaf. hit receives the block and lane of the nearest triangle
+    template <int N, typename R>
+    auto closest_hit_leaf_blocks(const std::vector<TriangleBlock<N>>& blocks, RayT<R>& ray,
+                                 TriangleBlockHit& hit) {
+        return [&](uint32_t offset, uint16_t count) {
+            TriangleBlockRay block_ray(ray);
+
+            auto tmin = (float)ray.tmin;
+            auto tmax = clamp_to_float(ray.tmax);
+
+            for (auto it = blocks.begin() + offset; count > 0; it++) {
+                float t;
+                int   lane;
+
+                if (intersect_triangle_block<N>(*it, block_ray, tmin, tmax, t, lane)) {
+                    tmax      = t;
+                    ray.tmax  = t;
+                    hit.block = (uint32_t)(it - blocks.begin());
+                    hit.lane  = lane;
+                }
+
+                count -= std::min<uint16_t>(count, N);
+            }
+
+            return false;
+        };
+    }
+
+    template <int N, typename R>
+    auto any_hit_leaf_blocks(const std::vector<TriangleBlock<N>>& blocks, const RayT<R>& ray) {
+        return [&](uint32_t offset, uint16_t count) {
+            TriangleBlockRay block_ray(ray);
+
+            auto tmin = (float)ray.tmin;
+            auto tmax = clamp_to_float(ray.tmax);
+
+            for (auto it = blocks.begin() + offset; count > 0; it++) {
+                float t;
+                int   lane;
+
+                if (intersect_triangle_block<N>(*it, block_ray, tmin, tmax, t, lane))
+                    return true;
+
+                count -= std::min<uint16_t>(count, N);
+            }
+
+            return false;
+        };
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderer/accel/bvh.hpp"
+
+namespace Oxy::Renderer {
+
+    // N children per node, bounds stored as structure of arrays so one ray can be tested
+    // against all children with a single simd pass
+    template <int N>
+    struct alignas(32) WideBVHNode {
+        static constexpr uint32_t empty_child = std::numeric_limits<uint32_t>::max();
+
+        float bbox_min[3][N];
+        float bbox_max[3][N];
+
+        uint32_t child[N];          // node index of inner children, primitive offset of leaves
+        uint16_t num_primitives[N]; // 0 for inner children
+
+        bool is_empty(int i) const { return child[i] == empty_child; }
+        bool is_leaf(int i) const { return num_primitives[i] != 0; }
+    };
+
+    template <typename T, int N>
+    struct WideBVH {
+        std::vector<WideBVHNode<N>> nodes;
+
+        BoundingBox bbox = empty_bbox();
+
+        bool empty() const { return nodes.empty(); }
+    };
+
+    // the ray in the form the simd box tests want it
+    struct WideBVHRay {
+        template <typename R>
+        WideBVHRay(const RayT<R>& ray) {
+            for (int axis = 0; axis < 3; axis++) {
+                origin[axis]  = (float)ray.origin[axis];
+                inv_dir[axis] = (float)ray.inv_dir[axis];
+            }
+
+            tmin = (float)ray.tmin;
+        }
+
+        float origin[3];
+        float inv_dir[3];
+        float tmin;
+    };
+
+    // grows the float box test a little so it stays conservative with rounded ray data
+    constexpr float wide_bvh_box_epsilon = 1.0f + 2.0f * 3.0f * 0.5f * 1.1920929e-7f;
+
+    // picks the binary nodes that become the children of the wide node made from index,
+    // returns their count
+    template <int N>
+    int collapse_bvh_children(const std::vector<LinearBVHNode>& nodes, uint32_t index,
+                              uint32_t* children) {
+        int num_children = 0;
+
+        if (nodes[index].is_leaf()) {
+            children[num_children++] = index;
+        }
+        else {
+            children[num_children++] = index + 1;
+            children[num_children++] = nodes[index].second_child_offset;
+        }
+
+        // keep opening the inner child with the largest surface area until the node is full
+        while (num_children < N) {
+            int    best_child = -1;
+            double best_area  = -1.0;
+
+            for (int i = 0; i < num_children; i++) {
+                const auto& child = nodes[children[i]];
+
+                if (!child.is_leaf() && surface_area(child.bbox()) > best_area) {
+                    best_area  = surface_area(child.bbox());
+                    best_child = i;
+                }
+            }
+
+            if (best_child == -1)
+                break;
+
+            auto opened              = children[best_child];
+            children[best_child]     = opened + 1;
+            children[num_children++] = nodes[opened].second_child_offset;
+        }
+
+        return num_children;
+    }
+
+    template <int N>
+    uint32_t collapse_bvh_node(const std::vector<LinearBVHNode>& nodes, uint32_t index,
+                               std::vector<WideBVHNode<N>>& wide_nodes) {
+
+        uint32_t children[N];
+        int      num_children = collapse_bvh_children<N>(nodes, index, children);
+
+        auto wide_index = (uint32_t)wide_nodes.size();
+        wide_nodes.emplace_back();
+
+        for (int i = 0; i < N; i++) {
+            // the recursion below appends to wide_nodes, so no reference is held across it
+            if (i >= num_children) {
+                for (int axis = 0; axis < 3; axis++) {
+                    wide_nodes[wide_index].bbox_min[axis][i] = std::numeric_limits<float>::max();
+                    wide_nodes[wide_index].bbox_max[axis][i] = std::numeric_limits<float>::lowest();
+                }
+
+                wide_nodes[wide_index].child[i]          = WideBVHNode<N>::empty_child;
+                wide_nodes[wide_index].num_primitives[i] = 0;
+                continue;
+            }
+
+            const auto& child = nodes[children[i]];
+
+            for (int axis = 0; axis < 3; axis++) {
+                wide_nodes[wide_index].bbox_min[axis][i] = child.bbox_min[axis];
+                wide_nodes[wide_index].bbox_max[axis][i] = child.bbox_max[axis];
+            }
+
+            if (child.is_leaf()) {
+                wide_nodes[wide_index].child[i]          = child.primitives_offset;
+                wide_nodes[wide_index].num_primitives[i] = child.num_primitives;
+            }
+            else {
+                auto child_index = collapse_bvh_node<N>(nodes, children[i], wide_nodes);
+
+                wide_nodes[wide_index].child[i]          = child_index;
+                wide_nodes[wide_index].num_primitives[i] = 0;
+            }
+        }
+
+        return wide_index;
+    }
+
+    template <int N, typename T>
+    WideBVH<T, N> collapse_bvh(const LinearBVH<T>& bvh) {
+        WideBVH<T, N> wide;
+
+        wide.bbox = bvh.bbox;
+
+        if (bvh.empty())
+            return wide;
+
+        wide.nodes.reserve(bvh.nodes.size() / (N - 1) + 1);
+        collapse_bvh_node<N>(bvh.nodes, 0, wide.nodes);
+        wide.nodes.shrink_to_fit();
+
+        return wide;
+    }
+
+    // tests the ray against every child of the node, returns a bitmask of the children hit
+    // and writes their entry distances to dist
+    template <int N>
+    inline int intersect_wide_node(const WideBVHNode<N>& node, const WideBVHRay& ray, float tmax,
+                                   float* dist) {
+        int mask = 0;
+
+        for (int i = 0; i < N; i++) {
+            float t_near = ray.tmin;
+            float t_far  = tmax;
+
+            for (int axis = 0; axis < 3; axis++) {
+                auto t0 = (node.bbox_min[axis][i] - ray.origin[axis]) * ray.inv_dir[axis];
+                auto t1 = (node.bbox_max[axis][i] - ray.origin[axis]) * ray.inv_dir[axis];
+
+                t_near = std::max(t_near, std::min(t0, t1));
+                t_far  = std::min(t_far, std::max(t0, t1));
+            }
+
+            dist[i] = t_near;
+
+            if (t_near <= t_far * wide_bvh_box_epsilon)
+                mask |= 1 << i;
+        }
+
+        return mask;
+    }
+
+#ifdef __SSE__
+    template <>
+    inline int intersect_wide_node<4>(const WideBVHNode<4>& node, const WideBVHRay& ray,
+                                      float tmax, float* dist) {
+        auto t_near = _mm_set1_ps(ray.tmin);
+        auto t_far  = _mm_set1_ps(tmax);
+
+        for (int axis = 0; axis < 3; axis++) {
+            auto origin  = _mm_set1_ps(ray.origin[axis]);
+            auto inv_dir = _mm_set1_ps(ray.inv_dir[axis]);
+
+            auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bbox_min[axis]), origin), inv_dir);
+            auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bbox_max[axis]), origin), inv_dir);
+
+            // max/min return the second operand on nan, which keeps nan slabs from spreading
+            t_near = _mm_max_ps(_mm_min_ps(t0, t1), t_near);
+            t_far  = _mm_min_ps(_mm_max_ps(t0, t1), t_far);
+        }
+
+        _mm_storeu_ps(dist, t_near);
+
+        t_far = _mm_mul_ps(t_far, _mm_set1_ps(wide_bvh_box_epsilon));
+
+        return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+    }
+#endif
+
+#ifdef __AVX__
+    template <>
+    inline int intersect_wide_node<8>(const WideBVHNode<8>& node, const WideBVHRay& ray,
+                                      float tmax, float* dist) {
+        auto t_near = _mm256_set1_ps(ray.tmin);
+        auto t_far  = _mm256_set1_ps(tmax);
+
+        for (int axis = 0; axis < 3; axis++) {
+            auto origin  = _mm256_set1_ps(ray.origin[axis]);
+            auto inv_dir = _mm256_set1_ps(ray.inv_dir[axis]);
+
+            auto t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bbox_min[axis]), origin),
+                                    inv_dir);
+            auto t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bbox_max[axis]), origin),
+                                    inv_dir);
+
+            t_near = _mm256_max_ps(_mm256_min_ps(t0, t1), t_near);
+            t_far  = _mm256_min_ps(_mm256_max_ps(t0, t1), t_far);
+        }
+
+        _mm256_storeu_ps(dist, t_near);
+
+        t_far = _mm256_mul_ps(t_far, _mm256_set1_ps(wide_bvh_box_epsilon));
+
+        return _mm256_movemask_ps(_mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ));
+    }
+#endif
+
+    struct WideBVHStackEntry {
+        uint32_t index;          // node index, or primitive offset for leaves
+        uint16_t num_primitives; // 0 for inner nodes
+        float    dist;           // entry distance, used to skip entries behind a closer hit
+    };
+
+    // walks the tree and calls leaf_fn(primitives_offset, num_primitives) for every leaf the
+    // ray passes through, children are visited near to far. same contract as
+    // linear_bvh_traverse: leaf_fn shrinks ray.tmax on hits and returns true to stop
+    template <int N, typename R, typename LeafFn>
+    bool wide_bvh_traverse(const std::vector<WideBVHNode<N>>& nodes, RayT<R>& ray,
+                           LeafFn&& leaf_fn) {
+        if (nodes.empty())
+            return false;
+
+        WideBVHRay wide_ray(ray);
+
+        WideBVHStackEntry stack[bvh_stack_size(N)];
+        int               stack_ptr = 0;
+
+        stack[stack_ptr++] = {0, 0, wide_ray.tmin};
+
+        while (stack_ptr != 0) {
+            auto entry = stack[--stack_ptr];
+
+            if (entry.dist > ray.tmax * wide_bvh_box_epsilon)
+                continue;
+
+            if (entry.num_primitives != 0) {
+                if (leaf_fn(entry.index, entry.num_primitives))
+                    return true;
+
+                continue;
+            }
+
+            const auto& node = nodes[entry.index];
+
+            alignas(32) float dist[N];
+            auto mask = intersect_wide_node<N>(node, wide_ray, clamp_to_float(ray.tmax), dist);
+
+            // sort the hit children far to near, so the nearest one ends up on top of the stack
+            int hit_children[N];
+            int num_hit = 0;
+
+            for (int i = 0; i < N; i++) {
+                if ((mask & (1 << i)) == 0 || node.is_empty(i))
+                    continue;
+
+                int slot = num_hit++;
+                while (slot > 0 && dist[hit_children[slot - 1]] < dist[i]) {
+                    hit_children[slot] = hit_children[slot - 1];
+                    slot--;
+                }
+
+                hit_children[slot] = i;
+            }
+
+            for (int i = 0; i < num_hit; i++) {
+                auto child         = hit_children[i];
+                stack[stack_ptr++] = {node.child[child], node.num_primitives[child], dist[child]};
+            }
+        }
+
+        return false;
+    }
+
+    template <typename T, int N, typename R>
+    bool wide_bvh_traverse_generic(const WideBVH<T, N>& bvh, const std::vector<T>& primitives,
+                                   RayT<R> ray, BVHTraverseResultT<R>& res) {
+        const T* hitprim = nullptr;
+
+        wide_bvh_traverse<N>(bvh.nodes, ray, closest_hit_leaf(primitives, ray, hitprim));
+
+        return finish_closest_hit(ray, hitprim, res);
+    }
+
+    template <typename T, int N, typename R>
+    bool wide_bvh_occluded_generic(const WideBVH<T, N>& bvh, const std::vector<T>& primitives,
+                                   RayT<R> ray) {
+        return wide_bvh_traverse<N>(bvh.nodes, ray, any_hit_leaf(primitives, ray));
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,469 @@
+#include "renderer/benchmark.hpp"
+
+#include <filesystem>
+#include <random>
+#include <tuple>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "renderer/geometry/instance_set.hpp"
+#include "renderer/geometry/mesh.hpp"
+#include "renderer/geometry/primitive_group.hpp"
+#include "renderer/utils/sampler.hpp"
+#include "renderer/utils/thread_pool.hpp"
+
+namespace Oxy::Renderer {
+
+    std::vector<CameraRay> make_benchmark_rays(const std::pair<glm::dvec3, glm::dvec3>& bbox,
+                                               int width, int height) {
+        auto center = 0.5 * (bbox.first + bbox.second);
+        auto extent = bbox.second - bbox.first;
+
+        Camera camera;
+        camera.set_fov(50);
+        camera.set_pos(center + glm::dvec3(-1.2, -1.6, 0.8) * glm::length(extent));
+        camera.aim(center);
+
+        // jittered like the first pass of a render, the same rays on every run
+        Sampler sampler(SamplerType::Independent);
+
+        std::vector<CameraRay> rays;
+        rays.reserve(width * height);
+
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                rays.push_back(
+                    camera.get_ray(x, y, width, height, sampler.pixel(x, y, 0).get_2d()));
+
+        return rays;
+    }
+
+    // rays from every primary hit towards a point light above the box, with tmax set to the
+    // light distance like an integrator would
+    static std::vector<Ray> make_shadow_rays(const Mesh& mesh, const std::vector<CameraRay>& rays) {
+        auto [min, max] = mesh.bbox();
+        auto light      = 0.5 * (min + max) + glm::dvec3(1.0, 1.0, 2.0) * glm::length(max - min);
+
+        std::vector<Ray> shadow_rays;
+
+        for (const auto& ray : rays) {
+            IntersectionResult res;
+            if (!mesh.intersect_ray(ray.origin, ray.dir, res))
+                continue;
+
+            auto origin = glm::dvec3(res.hitpos) +
+                          glm::dvec3(res.hitnormal) * 1e-6 * glm::length(max - min);
+            auto dist = glm::length(light - origin);
+
+            shadow_rays.emplace_back(origin, (light - origin) / dist, 0, dist);
+        }
+
+        return shadow_rays;
+    }
+
+    static void benchmark_layouts(const std::string& mesh_file) {
+        // layout, build method, optimize passes
+        const std::tuple<BVHLayout, BVHBuildMethod, int, const char*> layouts[] = {
+            {BVHLayout::Binary, BVHBuildMethod::SAH, 0, "binary"},
+            {BVHLayout::Binary, BVHBuildMethod::SAH, 3, "binary optimized"},
+            {BVHLayout::Wide4, BVHBuildMethod::SAH, 0, "bvh4"},
+            {BVHLayout::Wide8, BVHBuildMethod::SAH, 0, "bvh8"},
+            {BVHLayout::Wide8, BVHBuildMethod::SAH, 3, "bvh8 optimized"},
+            {BVHLayout::Wide8, BVHBuildMethod::LBVH, 0, "bvh8 lbvh"},
+            {BVHLayout::Wide8, BVHBuildMethod::SBVH, 0, "bvh8 sbvh"},
+            {BVHLayout::Compressed, BVHBuildMethod::SAH, 0, "bvh8 compressed"},
+        };
+
+        std::vector<CameraRay> rays;
+        std::vector<Ray>       shadow_rays;
+
+        for (auto [layout, method, optimize_passes, name] : layouts) {
+            Mesh mesh(mesh_file);
+
+            BVHBuildParams params;
+            params.layout          = layout;
+            params.method          = method;
+            params.optimize_passes = optimize_passes;
+            mesh.set_bvh_params(params);
+            mesh.set_cache_dir("");
+
+            if (!mesh.setup()) {
+                std::cout << "benchmark: could not load " << mesh_file << "\n";
+                return;
+            }
+
+            if (rays.empty()) {
+                rays        = make_benchmark_rays(mesh.bbox(), 512, 512);
+                shadow_rays = make_shadow_rays(mesh, rays);
+            }
+
+            std::string prefix(name);
+
+            std::cout << run_benchmark(prefix + " primary closest-hit", rays, 4,
+                                       [&](const CameraRay& ray) {
+                                           IntersectionResult res;
+                                           mesh.intersect_ray(ray.origin, ray.dir, res);
+                                       })
+                      << "\n";
+
+            std::cout << run_benchmark(prefix + " primary occluded", rays, 4,
+                                       [&](const CameraRay& ray) {
+                                           mesh.occluded(ray.origin, ray.dir,
+                                                         std::numeric_limits<Real>::max());
+                                       })
+                      << "\n";
+
+            std::cout << run_benchmark(prefix + " shadow closest-hit", shadow_rays, 4,
+                                       [&](const Ray& ray) {
+                                           IntersectionResult res;
+                                           res.t = ray.tmax;
+                                           mesh.intersect_ray(ray.origin, ray.dir, res);
+                                       })
+                      << "\n";
+
+            std::cout << run_benchmark(prefix + " shadow occluded", shadow_rays, 4,
+                                       [&](const Ray& ray) {
+                                           mesh.occluded(ray.origin, ray.dir, ray.tmax);
+                                       })
+                      << "\n";
+        }
+    }
+
+    // the same primary rays traced as float and as double rays through the same mesh. both end
+    // up in the same float triangle kernel, so any hit that differs was lost or gained by the
+    // box tests of the traversal
+    static void benchmark_precision(const std::string& mesh_file) {
+        const std::pair<BVHLayout, const char*> layouts[] = {
+            {BVHLayout::Binary, "binary"},
+            {BVHLayout::Wide8, "bvh8"},
+        };
+
+        for (auto [layout, name] : layouts) {
+            Mesh mesh(mesh_file);
+
+            BVHBuildParams params;
+            params.layout = layout;
+            mesh.set_bvh_params(params);
+            mesh.set_cache_dir("");
+
+            if (!mesh.setup()) {
+                std::cout << "benchmark: could not load " << mesh_file << "\n";
+                return;
+            }
+
+            auto camera_rays = make_benchmark_rays(mesh.bbox(), 512, 512);
+
+            auto make_rays = [&](auto real) {
+                using R = decltype(real);
+
+                std::vector<RayT<R>> rays;
+                rays.reserve(camera_rays.size());
+
+                for (const auto& ray : camera_rays)
+                    rays.emplace_back(Vec3<R>(ray.origin), Vec3<R>(ray.dir));
+
+                return rays;
+            };
+
+            auto float_rays  = make_rays(0.0f);
+            auto double_rays = make_rays(0.0);
+
+            auto closest_hit = [&](auto ray) {
+                TriangleBlockHit hit;
+                mesh.closest_hit(ray, hit);
+                return hit;
+            };
+
+            std::string prefix(name);
+
+            std::cout << run_benchmark(prefix + " float closest-hit", float_rays, 4, closest_hit)
+                      << "\n";
+            std::cout << run_benchmark(prefix + " double closest-hit", double_rays, 4, closest_hit)
+                      << "\n";
+
+            size_t num_hits = 0, num_different = 0;
+
+            for (size_t i = 0; i < camera_rays.size(); i++) {
+                auto float_hit  = closest_hit(float_rays[i]);
+                auto double_hit = closest_hit(double_rays[i]);
+
+                num_hits += double_hit.hit();
+                num_different +=
+                    float_hit.block != double_hit.block || float_hit.lane != double_hit.lane;
+            }
+
+            std::cout << prefix << " float vs double: " << num_different << " of " << num_hits
+                      << " hits differ\n";
+        }
+    }
+
+    // the same primary rays regrouped into 4x4 pixel tiles, traced one by one and as packets
+    // through the same mesh. packets have to find exactly the hits of the single rays
+    static void benchmark_packets(const std::string& mesh_file) {
+        Mesh mesh(mesh_file);
+        mesh.set_cache_dir("");
+
+        if (!mesh.setup()) {
+            std::cout << "benchmark: could not load " << mesh_file << "\n";
+            return;
+        }
+
+        constexpr int width = 512, height = 512;
+
+        auto camera_rays = make_benchmark_rays(mesh.bbox(), width, height);
+
+        std::vector<Ray>    rays;
+        std::vector<size_t> packets;
+
+        for (int tile_y = 0; tile_y < height; tile_y += ray_packet_tile)
+            for (int tile_x = 0; tile_x < width; tile_x += ray_packet_tile) {
+                packets.push_back(rays.size());
+
+                for (int y = tile_y; y < tile_y + ray_packet_tile; y++)
+                    for (int x = tile_x; x < tile_x + ray_packet_tile; x++)
+                        rays.emplace_back(camera_rays[x + y * width].origin,
+                                          camera_rays[x + y * width].dir);
+            }
+
+        std::vector<TriangleBlockHit> single_hits(rays.size()), packet_hits(rays.size());
+
+        auto trace_packet = [&](size_t first) {
+            Ray packet[ray_packet_size];
+            std::copy(rays.begin() + first, rays.begin() + first + ray_packet_size, packet);
+
+            mesh.closest_hit_packet(packet, ray_packet_size, &packet_hits[first]);
+        };
+
+        std::cout << run_benchmark("single closest-hit", rays, 4,
+                                   [&](const Ray& ray) {
+                                       auto             single_ray = ray;
+                                       TriangleBlockHit hit;
+                                       mesh.closest_hit(single_ray, hit);
+                                   })
+                  << "\n";
+
+        auto packet_result = run_benchmark("packet closest-hit", packets, 4, trace_packet);
+        packet_result.num_rays *= ray_packet_size;
+
+        std::cout << packet_result << "\n";
+
+        size_t num_hits = 0, num_different = 0;
+
+        for (size_t i = 0; i < rays.size(); i++) {
+            auto single_ray = rays[i];
+            mesh.closest_hit(single_ray, single_hits[i]);
+
+            num_hits += single_hits[i].hit();
+            num_different += single_hits[i].block != packet_hits[i].block ||
+                             single_hits[i].lane != packet_hits[i].lane;
+        }
+
+        std::cout << "packet vs single: " << num_different << " of " << num_hits
+                  << " hits differ\n";
+    }
+
+    // time spent in Mesh::setup for each builder, on one thread and on the whole pool
+    static void benchmark_build(const std::string& mesh_file) {
+        auto time_setup = [&](BVHBuildMethod method, size_t parallel_threshold) {
+            Mesh mesh(mesh_file);
+
+            BVHBuildParams params;
+            params.method             = method;
+            params.parallel_threshold = parallel_threshold;
+            mesh.set_bvh_params(params);
+            mesh.set_cache_dir("");
+
+            auto start = std::chrono::high_resolution_clock::now();
+
+            if (!mesh.setup())
+                return -1.0;
+
+            std::chrono::duration<double> elapsed =
+                std::chrono::high_resolution_clock::now() - start;
+
+            return elapsed.count();
+        };
+
+        const std::pair<BVHBuildMethod, const char*> methods[] = {
+            {BVHBuildMethod::SAH, "sah"},
+            {BVHBuildMethod::LBVH, "lbvh"},
+        };
+
+        auto num_threads = ThreadPool::global().num_workers() + 1;
+
+        for (auto [method, name] : methods) {
+            auto serial   = time_setup(method, std::numeric_limits<size_t>::max());
+            auto parallel = time_setup(method, BVHBuildParams{}.parallel_threshold);
+
+            if (serial < 0.0 || parallel < 0.0) {
+                std::cout << "benchmark: could not load " << mesh_file << "\n";
+                return;
+            }
+
+            std::cout << "build " << name << " 1 thread: " << serial * 1e3 << " ms\n";
+            std::cout << "build " << name << " " << num_threads << " threads: " << parallel * 1e3
+                      << " ms (" << serial / parallel << "x)\n";
+        }
+    }
+
+    // Mesh::setup with an empty cache directory, then again loading what the first run wrote
+    static void benchmark_cache(const std::string& mesh_file) {
+        auto cache_dir = std::filesystem::temp_directory_path() / "oxy_benchmark_cache";
+
+        std::error_code ec;
+        std::filesystem::remove_all(cache_dir, ec);
+
+        auto time_setup = [&]() {
+            Mesh mesh(mesh_file);
+            mesh.set_cache_dir(cache_dir.string());
+
+            auto start = std::chrono::high_resolution_clock::now();
+
+            if (!mesh.setup())
+                return -1.0;
+
+            std::chrono::duration<double> elapsed =
+                std::chrono::high_resolution_clock::now() - start;
+
+            return elapsed.count();
+        };
+
+        auto cold = time_setup();
+        auto warm = time_setup();
+
+        std::filesystem::remove_all(cache_dir, ec);
+
+        if (cold < 0.0 || warm < 0.0) {
+            std::cout << "benchmark: could not load " << mesh_file << "\n";
+            return;
+        }
+
+        std::cout << "setup without cache: " << cold * 1e3 << " ms\n";
+        std::cout << "setup from cache: " << warm * 1e3 << " ms (" << cold / warm << "x)\n";
+    }
+
+    // a field of randomly turned copies of the mesh in one InstanceSet, all sharing the bvh
+    // of the mesh. reports the setup time and the memory of the top level
+    static void benchmark_instances(const std::string& mesh_file) {
+        constexpr int grid = 1024; // grid * grid instances
+
+        Mesh mesh(mesh_file);
+        mesh.set_cache_dir("");
+
+        if (!mesh.setup()) {
+            std::cout << "benchmark: could not load " << mesh_file << "\n";
+            return;
+        }
+
+        auto [min, max] = mesh.local_bbox();
+        auto spacing    = glm::length(max - min);
+
+        std::mt19937                           rng(1);
+        std::uniform_real_distribution<double> angle(0.0, 6.283185307179586);
+
+        InstanceSet instances;
+        instances.reserve((size_t)grid * grid);
+
+        for (int y = 0; y < grid; y++)
+            for (int x = 0; x < grid; x++) {
+                auto transform = glm::translate(glm::dmat4(1.0), glm::dvec3(x, y, 0.0) * spacing);
+                transform      = glm::rotate(transform, angle(rng), glm::dvec3(0, 0, 1));
+
+                instances.add_instance(&mesh, transform);
+            }
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        instances.setup();
+
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        std::cout << "instances setup: " << elapsed.count() * 1e3 << " ms, "
+                  << (double)instances.memory_usage() / instances.num_instances()
+                  << " bytes per instance\n";
+
+        auto rays = make_benchmark_rays(instances.bbox(), 512, 512);
+
+        std::cout << run_benchmark("instances primary closest-hit", rays, 4,
+                                   [&](const CameraRay& ray) {
+                                       IntersectionResult res;
+                                       instances.intersect_ray(ray.origin, ray.dir, res);
+                                   })
+                  << "\n";
+    }
+
+    // a point cloud of analytic spheres in a PrimitiveGroup, no mesh file involved
+    static void benchmark_spheres() {
+        constexpr size_t num_spheres = 1 << 20;
+
+        std::mt19937                           rng(1);
+        std::uniform_real_distribution<double> position(-100.0, 100.0);
+        std::uniform_real_distribution<double> radius(0.05, 0.25);
+
+        std::vector<Sphere> spheres;
+        spheres.reserve(num_spheres);
+
+        for (size_t i = 0; i < num_spheres; i++)
+            spheres.emplace_back(glm::dvec3(position(rng), position(rng), position(rng)),
+                                 radius(rng));
+
+        const std::pair<BVHLayout, const char*> layouts[] = {
+            {BVHLayout::Binary, "binary"},
+            {BVHLayout::Wide8, "bvh8"},
+        };
+
+        for (auto [layout, name] : layouts) {
+            PrimitiveGroup cloud({}, spheres);
+
+            BVHBuildParams params;
+            params.layout = layout;
+            cloud.set_bvh_params(params);
+
+            auto start = std::chrono::high_resolution_clock::now();
+
+            cloud.setup();
+
+            std::chrono::duration<double> elapsed =
+                std::chrono::high_resolution_clock::now() - start;
+
+            std::string prefix = std::string(name) + " spheres";
+
+            std::cout << prefix << " setup: " << elapsed.count() * 1e3 << " ms, "
+                      << (double)cloud.accelerator().memory_usage() / num_spheres
+                      << " bytes per sphere\n";
+
+            auto rays = make_benchmark_rays(cloud.bbox(), 512, 512);
+
+            std::cout << run_benchmark(prefix + " primary closest-hit", rays, 4,
+                                       [&](const CameraRay& ray) {
+                                           IntersectionResult res;
+                                           cloud.intersect_ray(ray.origin, ray.dir, res);
+                                       })
+                      << "\n";
+
+            // counted so the query is not optimized away, the whole group is inlined here
+            size_t num_occluded = 0;
+
+            std::cout << run_benchmark(prefix + " primary occluded", rays, 4,
+                                       [&](const CameraRay& ray) {
+                                           num_occluded += cloud.occluded(
+                                               ray.origin, ray.dir,
+                                               std::numeric_limits<Real>::max());
+                                       })
+                      << ", " << num_occluded / 4 << " occluded\n";
+        }
+    }
+
+    int run_benchmarks(const std::string& mesh_file) {
+        benchmark_cache(mesh_file);
+        benchmark_build(mesh_file);
+        benchmark_layouts(mesh_file);
+        benchmark_precision(mesh_file);
+        benchmark_packets(mesh_file);
+        benchmark_instances(mesh_file);
+        benchmark_spheres();
+
+        return 0;
+    }
+
+} // namespace Oxy::Renderer
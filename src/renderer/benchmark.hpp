@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderer/utils/camera.hpp"
+#include "renderer/utils/ray.hpp"
+
+namespace Oxy::Renderer {
+
+    struct BenchmarkResult {
+        std::string name;
+        size_t      num_rays = 0;
+        double      seconds  = 0.0;
+
+        double rays_per_second() const { return seconds > 0.0 ? num_rays / seconds : 0.0; }
+    };
+
+    inline std::ostream& operator<<(std::ostream& os, const BenchmarkResult& result) {
+        return os << result.name << ": " << result.rays_per_second() * 1e-6 << " Mrays/s ("
+                  << result.num_rays << " rays in " << result.seconds << " s)";
+    }
+
+    // primary rays of a camera looking at a bounding box, generated once so every
+    // configuration traces exactly the same set
+    std::vector<CameraRay> make_benchmark_rays(const std::pair<glm::dvec3, glm::dvec3>& bbox,
+                                               int width, int height);
+
+    template <typename RayType, typename Fn>
+    BenchmarkResult run_benchmark(const std::string& name, const std::vector<RayType>& rays,
+                                  int repetitions, Fn&& trace_fn) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < repetitions; i++)
+            for (const auto& ray : rays)
+                trace_fn(ray);
+
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        return {name, rays.size() * repetitions, elapsed.count()};
+    }
+
+    // headless benchmarks, run with bigbong --benchmark [file.stl]
+    int run_benchmarks(const std::string& mesh_file);
+
+} // namespace Oxy::Renderer
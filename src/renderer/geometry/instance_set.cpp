@@ -0,0 +1,166 @@
+#include "renderer/geometry/instance_set.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+
+#include "renderer/utils/thread_pool.hpp"
+
+namespace Oxy::Renderer {
+
+    InstanceRecord InstanceRecord::make(uint32_t mesh, const glm::dmat4& transform) {
+        InstanceRecord instance;
+
+        auto inverse = glm::inverse(transform);
+
+        // glm is column major, the record keeps rows
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 4; col++)
+                instance.world_to_mesh[row][col] = (float)inverse[col][row];
+
+        instance.bbox_min = glm::vec3(0.0f);
+        instance.bbox_max = glm::vec3(0.0f);
+        instance.mesh     = mesh;
+
+        return instance;
+    }
+
+    glm::dmat4 InstanceRecord::mesh_to_world() const {
+        glm::dmat4 world_to_mesh_mat(1.0);
+
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 4; col++)
+                world_to_mesh_mat[col][row] = world_to_mesh[row][col];
+
+        return glm::inverse(world_to_mesh_mat);
+    }
+
+    uint32_t InstanceSet::add_mesh(Mesh* mesh) {
+        auto it = std::find(m_meshes.begin(), m_meshes.end(), mesh);
+
+        if (it != m_meshes.end())
+            return (uint32_t)(it - m_meshes.begin());
+
+        m_meshes.push_back(mesh);
+
+        return (uint32_t)m_meshes.size() - 1;
+    }
+
+    bool InstanceSet::setup() {
+        // meshes that are already set up return right away. a mesh is not safe to set up from
+        // two threads at once, so with meshes shared across objects the scene sets them up
+        // before any set
+        std::atomic<bool> meshes_ok = true;
+
+        TaskGroup tasks;
+
+        for (auto mesh : m_meshes)
+            tasks.run([mesh, &meshes_ok] {
+                if (!mesh->setup())
+                    meshes_ok = false;
+            });
+
+        tasks.wait();
+
+        if (!meshes_ok)
+            return false;
+
+        parallel_for(0, m_instances.size(), bvh_build_grain, [&](size_t first, size_t last) {
+            for (auto i = first; i < last; i++) {
+                auto& instance = m_instances[i];
+
+                auto bbox = get_transformed_bbox(m_meshes[instance.mesh]->local_bbox(),
+                                                 instance.mesh_to_world());
+
+                for (int axis = 0; axis < 3; axis++) {
+                    instance.bbox_min[axis] = round_down(bbox.first[axis]);
+                    instance.bbox_max[axis] = round_up(bbox.second[axis]);
+                }
+            }
+        });
+
+        m_bvh = build_bvh_generic<InstanceRecord>(m_instances, 0, m_instances.size(),
+                                                  m_bvh_params);
+        m_bvh_report = compute_bvh_cost(m_bvh, m_bvh_params);
+
+        if (m_bvh_params.layout == BVHLayout::Wide4)
+            m_bvh4 = collapse_bvh<4>(m_bvh);
+
+        // the records are small and few next to the meshes they share, they are not worth
+        // compressing the nodes over
+        if (m_bvh_params.layout == BVHLayout::Wide8 ||
+            m_bvh_params.layout == BVHLayout::Compressed)
+            m_bvh8 = collapse_bvh<8>(m_bvh);
+
+        print_report();
+
+        return true;
+    }
+
+    bool InstanceSet::intersect_ray(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                                    IntersectionResult& res) const {
+        Ray ray(world_to_local(origin), world_to_local_dir(dir), 0, res.t);
+
+        const InstanceRecord* hit_instance = nullptr;
+        TriangleBlockHit      hit;
+
+        traverse(ray, [&](uint32_t offset, uint16_t count) {
+            for (auto i = offset; i < offset + count; i++) {
+                const auto& instance = m_instances[i];
+
+                auto             mesh_ray = instance.to_mesh(ray);
+                TriangleBlockHit mesh_hit;
+
+                if (m_meshes[instance.mesh]->closest_hit(mesh_ray, mesh_hit)) {
+                    ray.tmax     = mesh_ray.tmax;
+                    hit          = mesh_hit;
+                    hit_instance = &instance;
+                }
+            }
+
+            return false;
+        });
+
+        if (hit_instance == nullptr)
+            return false;
+
+        auto normal = hit_instance->normal_to_world(
+            Vec3<Real>(m_meshes[hit_instance->mesh]->hit_normal(hit)));
+
+        res.hit    = true;
+        res.hitobj = (Object*)this;
+
+        res.t         = ray.tmax;
+        res.hitnormal = local_to_world_normal(normal);
+        res.hitpos    = origin + dir * ray.tmax;
+
+        return true;
+    }
+
+    bool InstanceSet::occluded(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                               Real tmax) const {
+        Ray ray(world_to_local(origin), world_to_local_dir(dir), 0, tmax);
+
+        return traverse(ray, [&](uint32_t offset, uint16_t count) {
+            for (auto i = offset; i < offset + count; i++) {
+                const auto& instance = m_instances[i];
+
+                if (m_meshes[instance.mesh]->any_hit(instance.to_mesh(ray)))
+                    return true;
+            }
+
+            return false;
+        });
+    }
+
+    void InstanceSet::print_report() const {
+        std::ostringstream report;
+        report << "instances: " << m_instances.size() << " instances of " << m_meshes.size()
+               << " meshes, " << memory_usage() / (1024.0 * 1024.0) << " MB, " << m_bvh_report
+               << "\n";
+
+        std::cout << report.str();
+    }
+
+} // namespace Oxy::Renderer
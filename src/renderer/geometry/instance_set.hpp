@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "renderer/geometry/mesh.hpp"
+
+namespace Oxy::Renderer {
+
+    // one placement of a mesh as it is stored in the top level bvh of an InstanceSet: the
+    // affine transform from the space of the set into the space of the mesh as three float
+    // rows, the bounds in the space of the set and the index of the mesh. 76 bytes against
+    // the two double matrices a full Object carries
+    struct InstanceRecord {
+        float     world_to_mesh[3][4];
+        glm::vec3 bbox_min, bbox_max; // filled in by InstanceSet::setup, rounded outwards
+        uint32_t  mesh;
+
+        static InstanceRecord make(uint32_t mesh, const glm::dmat4& transform);
+
+        // the transform the float rows actually describe, used for the bounds
+        glm::dmat4 mesh_to_world() const;
+
+        // the ray in the space of the mesh with the same tmin and tmax, the direction is not
+        // normalized so the hit distances carry over unchanged
+        template <typename R>
+        RayT<R> to_mesh(const RayT<R>& ray) const {
+            Vec3<R> origin, dir;
+
+            for (int row = 0; row < 3; row++) {
+                const auto& m = world_to_mesh[row];
+
+                dir[row] = R(m[0]) * ray.dir.x + R(m[1]) * ray.dir.y + R(m[2]) * ray.dir.z;
+                origin[row] = R(m[0]) * ray.origin.x + R(m[1]) * ray.origin.y +
+                              R(m[2]) * ray.origin.z + R(m[3]);
+            }
+
+            return RayT<R>(origin, dir, ray.tmin, ray.tmax);
+        }
+
+        // normals go back through the transpose of world_to_mesh, its inverse transpose
+        template <typename R>
+        Vec3<R> normal_to_world(const Vec3<R>& normal) const {
+            Vec3<R> out(0);
+
+            for (int row = 0; row < 3; row++)
+                for (int col = 0; col < 3; col++)
+                    out[col] += R(world_to_mesh[row][col]) * normal[row];
+
+            return glm::normalize(out);
+        }
+    };
+
+    static_assert(sizeof(InstanceRecord) == 76, "instance records are kept compact");
+
+    template <>
+    inline BoundingBox PrimitiveTraits::bbox(const InstanceRecord& instance) {
+        return {glm::dvec3(instance.bbox_min), glm::dvec3(instance.bbox_max)};
+    }
+
+    template <>
+    inline BoundingSphere PrimitiveTraits::bsphere(const InstanceRecord& instance) {
+        auto min = glm::dvec3(instance.bbox_min), max = glm::dvec3(instance.bbox_max);
+        return {0.5 * (min + max), 0.5 * glm::length(max - min)};
+    }
+
+    template <>
+    inline glm::dvec3 PrimitiveTraits::midpoint(const InstanceRecord& instance) {
+        return 0.5 * (glm::dvec3(instance.bbox_min) + glm::dvec3(instance.bbox_max));
+    }
+
+    // two level instancing: many placements of a few meshes as compact InstanceRecords under
+    // one top level bvh, while every mesh and its bvh is built and stored once. a ray is only
+    // moved into the space of a mesh once it reaches one of its instances.
+    // the meshes are not owned and have to outlive the set, setup reorders the instances
+    class InstanceSet final : public Object {
+    public:
+        // index of the mesh within the set, adding a mesh again returns its existing index
+        uint32_t add_mesh(Mesh* mesh);
+
+        void add_instance(uint32_t mesh, const glm::dmat4& transform) {
+            m_instances.push_back(InstanceRecord::make(mesh, transform));
+        }
+
+        void add_instance(Mesh* mesh, const glm::dmat4& transform) {
+            add_instance(add_mesh(mesh), transform);
+        }
+
+        void reserve(size_t num_instances) { m_instances.reserve(num_instances); }
+
+        const auto& meshes() const { return m_meshes; }
+
+        virtual bool setup() override;
+
+        virtual bool intersect_ray(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                                   IntersectionResult& res) const override;
+
+        virtual bool occluded(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                              Real tmax) const override;
+
+        virtual BoundingBox bbox() const override {
+            return get_transformed_bbox(m_bvh.bbox, m_transform);
+        }
+
+        virtual BoundingBox local_bbox() const override { return m_bvh.bbox; }
+
+        virtual BoundingSphere bsphere() const override {
+            return get_transformed_bsphere(m_bvh.bsphere, m_transform);
+        }
+
+        virtual BoundingSphere local_bsphere() const override { return m_bvh.bsphere; }
+
+        void set_bvh_params(const BVHBuildParams& params) {
+            m_bvh_params = params;
+
+            // instances are tested with a whole mesh traversal each, duplicating one costs far
+            // more than the box overlap it would save
+            if (m_bvh_params.method == BVHBuildMethod::SBVH)
+                m_bvh_params.method = BVHBuildMethod::SAH;
+        }
+
+        const auto& bvh_report() const { return m_bvh_report; }
+
+        auto num_instances() const { return m_instances.size(); }
+
+        // the records and the top level nodes, the shared meshes are not counted
+        size_t memory_usage() const {
+            return m_instances.size() * sizeof(InstanceRecord) +
+                   m_bvh.nodes.size() * sizeof(LinearBVHNode) +
+                   m_bvh4.nodes.size() * sizeof(WideBVHNode<4>) +
+                   m_bvh8.nodes.size() * sizeof(WideBVHNode<8>);
+        }
+
+    private:
+        void print_report() const;
+
+        // runs leaf_fn over the leaves of whichever layout was built, leaves index m_instances
+        template <typename R, typename LeafFn>
+        bool traverse(RayT<R>& ray, LeafFn&& leaf_fn) const {
+            switch (m_bvh_params.layout) {
+            case BVHLayout::Binary: return linear_bvh_traverse(m_bvh.nodes, ray, leaf_fn);
+            case BVHLayout::Wide4: return wide_bvh_traverse<4>(m_bvh4.nodes, ray, leaf_fn);
+            case BVHLayout::Wide8:
+            case BVHLayout::Compressed: return wide_bvh_traverse<8>(m_bvh8.nodes, ray, leaf_fn);
+            }
+
+            return false;
+        }
+
+    private:
+        BVHBuildParams m_bvh_params;
+        BVHCostReport  m_bvh_report;
+
+        LinearBVH<InstanceRecord>   m_bvh;
+        WideBVH<InstanceRecord, 4>  m_bvh4;
+        WideBVH<InstanceRecord, 8>  m_bvh8;
+        std::vector<InstanceRecord> m_instances;
+
+        std::vector<Mesh*> m_meshes;
+    };
+
+} // namespace Oxy::Renderer
@@ -1,63 +1,193 @@
 #include "renderer/geometry/mesh.hpp"
 
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+
 #include "renderer/parsers/stl.hpp"
+#include "renderer/utils/binary_cache.hpp"
 
 namespace Oxy::Renderer {
 
+    // bump whenever the meaning of anything written to the cache changes
+    static constexpr uint32_t mesh_cache_version = 5;
+
+    // the file contents plus every build parameter that changes the result
+    static uint64_t mesh_cache_key(const MappedFile& file, const BVHBuildParams& params) {
+        auto key = hash_bytes(file.data(), file.size());
+
+        key = hash_value(mesh_cache_version, key);
+        key = hash_value(params.num_bins, key);
+        key = hash_value(params.traversal_cost, key);
+        key = hash_value(params.intersection_cost, key);
+        key = hash_value(params.max_leaf_size, key);
+        key = hash_value(params.leaf_block_size, key);
+        key = hash_value(params.method, key);
+        key = hash_value(params.spatial_split_alpha, key);
+        key = hash_value(params.spatial_split_budget, key);
+        key = hash_value(params.optimize_passes, key);
+        key = hash_value(params.layout, key);
+
+        key = hash_value(bvh_max_depth, key);
+        key = hash_value(bvh_treelet_size, key);
+        key = hash_value(sizeof(LinearBVHNode), key);
+        key = hash_value(sizeof(CompressedBVHNode<compressed_bvh_width>), key);
+        key = hash_value(sizeof(TriangleBlock<triangle_block_width>), key);
+
+        return key;
+    }
+
     Mesh::Mesh(const std::string& filename)
         : m_errored(false)
-        , m_bvh(nullptr) {
+        , m_filename(filename) {
 
-        if (filename.ends_with(".stl")) {
-            auto err = Parsers::parse_stl(filename.c_str(), m_triangles);
-
-            if (err.has_value())
-                m_errored = true;
-        }
-        else {
+        if (!filename.ends_with(".stl"))
             m_errored = true;
-        }
     }
 
     Mesh::Mesh(const std::vector<Triangle>& triangles)
         : m_errored(false)
-        , m_bvh(nullptr)
         , m_triangles(triangles) {}
 
-    Mesh::~Mesh() {
-        if (m_bvh != nullptr)
-            delete m_bvh;
-    }
-
     bool Mesh::setup() {
         if (m_errored)
             return false;
 
-        m_bvh = build_bvh_generic<Triangle>(m_triangles, 0, m_triangles.size());
+        // the source triangles are released after the first setup, there is nothing to
+        // rebuild from
+        if (!m_tree.empty())
+            return true;
+
+        std::string cache_path;
+        uint64_t    cache_key = 0;
+
+        if (!m_filename.empty() && !m_cache_dir.empty()) {
+            MappedFile file;
+
+            if (file.open(m_filename)) {
+                cache_key = mesh_cache_key(
+                    file, block_build_params(m_bvh_params, triangle_block_width));
+
+                char name[32];
+                std::snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)cache_key);
+
+                cache_path = (std::filesystem::path(m_cache_dir) / name).string();
+
+                if (load_cache(cache_path, cache_key)) {
+                    print_report("loaded from cache");
+                    return true;
+                }
+            }
+        }
+
+        if (!m_filename.empty()) {
+            m_triangles.clear();
+
+            if (Parsers::parse_stl(m_filename.c_str(), m_triangles).has_value()) {
+                m_errored = true;
+                return false;
+            }
+        }
+
+        // everything traversal needs ends up in the blocks, the double precision triangles
+        // are released by the build
+        build_accelerator_tree(m_tree, m_triangles, m_bvh_params, triangle_block_width,
+                               pack_triangle_blocks<triangle_block_width>);
+
+        if (!cache_path.empty())
+            save_cache(cache_path, cache_key);
+
+        print_report("built");
 
         return true;
     }
 
-    bool Mesh::intersect_ray(const glm::dvec3& origin, const glm::dvec3& dir,
-                             IntersectionResult& res) const {
+    bool Mesh::load_cache(const std::string& path, uint64_t key) {
+        CacheReader reader;
 
-        BVHTraverseResult bvh_res;
+        if (!reader.open(path, key))
+            return false;
 
-        auto tr_origin = local_to_world(origin);
-        auto tr_dir    = local_to_world_dir(dir);
+        // read in the order save_cache writes
+        return reader.read_value(m_tree.num_primitives) && reader.read(m_tree.bvh.nodes) &&
+               reader.read(m_tree.bvh4.nodes) && reader.read(m_tree.bvh8.nodes) &&
+               reader.read(m_tree.cbvh.nodes) && reader.read_value(m_tree.cbvh.leaf_width) &&
+               reader.read(m_tree.blocks) && reader.read_value(m_tree.bvh.bbox.first) &&
+               reader.read_value(m_tree.bvh.bbox.second) &&
+               reader.read_value(m_tree.bvh.bsphere.first) &&
+               reader.read_value(m_tree.bvh.bsphere.second) && reader.read_value(m_tree.report) &&
+               reader.read_value(m_tree.optimize_report);
+    }
 
-        if (dumb_bvh_traverse_generic<Triangle>(m_bvh, m_triangles, tr_origin, tr_dir, bvh_res)) {
-            res.hit    = true;
-            res.hitobj = (Object*)this;
+    void Mesh::save_cache(const std::string& path, uint64_t key) const {
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+        CacheWriter writer(path, key);
+
+        writer.write_value(m_tree.num_primitives);
+        writer.write(m_tree.bvh.nodes);
+        writer.write(m_tree.bvh4.nodes);
+        writer.write(m_tree.bvh8.nodes);
+        writer.write(m_tree.cbvh.nodes);
+        writer.write_value(m_tree.cbvh.leaf_width);
+        writer.write(m_tree.blocks);
+        writer.write_value(m_tree.bvh.bbox.first);
+        writer.write_value(m_tree.bvh.bbox.second);
+        writer.write_value(m_tree.bvh.bsphere.first);
+        writer.write_value(m_tree.bvh.bsphere.second);
+        writer.write_value(m_tree.report);
+        writer.write_value(m_tree.optimize_report);
+
+        if (!writer.finish())
+            std::cout << "mesh: could not write cache " << path << "\n";
+    }
 
-            res.t         = bvh_res.t;
-            res.hitnormal = bvh_res.hitnormal;
-            res.hitpos    = origin + dir * bvh_res.t;
+    void Mesh::print_report(const char* source) const {
+        std::ostringstream report;
+        report << "mesh: " << m_tree.num_primitives << " triangles in " << m_tree.blocks.size()
+               << " blocks " << source << ", " << memory_per_triangle() << " bytes per triangle, "
+               << m_tree.report << "\n";
 
-            return true;
+        if (m_tree.optimize_report.passes != 0)
+            report << "  optimized: " << m_tree.optimize_report << "\n";
+
+        std::cout << report.str();
+    }
+
+    void Mesh::intersect_packet(const Ray* rays, uint32_t mask,
+                                IntersectionResult* results) const {
+        Ray              local_rays[ray_packet_size];
+        TriangleBlockHit hits[ray_packet_size];
+        int              ray_index[ray_packet_size];
+        int              count = 0;
+
+        for (; mask != 0; mask &= mask - 1) {
+            auto i = __builtin_ctz(mask);
+
+            auto tr_origin = world_to_local(rays[i].origin);
+            auto tr_dir    = world_to_local_dir(rays[i].dir);
+
+            local_rays[count]  = Ray(tr_origin, tr_dir, 0, results[i].t);
+            ray_index[count++] = i;
         }
 
-        return false;
+        closest_hit_packet(local_rays, count, hits);
+
+        for (int k = 0; k < count; k++) {
+            if (!hits[k].hit())
+                continue;
+
+            auto& res = results[ray_index[k]];
+            auto& ray = rays[ray_index[k]];
+
+            res.hit    = true;
+            res.hitobj = (Object*)this;
+
+            res.t         = local_rays[k].tmax;
+            res.hitnormal = local_to_world_normal(hit_normal(hits[k]));
+            res.hitpos    = ray.origin + ray.dir * res.t;
+        }
     }
 
 } // namespace Oxy::Renderer
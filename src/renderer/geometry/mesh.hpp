@@ -5,8 +5,9 @@
 
 #include "renderer/geometry/object.hpp"
 
-#include "renderer/accel/bvh.hpp"
+#include "renderer/accel/accelerator.hpp"
 #include "renderer/accel/primitive_traits.hpp"
+#include "renderer/accel/ray_packet.hpp"
 
 namespace Oxy::Renderer {
 
@@ -14,39 +15,146 @@ namespace Oxy::Renderer {
     public:
         Mesh(const std::string& filename);
         Mesh(const std::vector<Triangle>& tris);
-        ~Mesh();
 
-        virtual bool intersect_ray(const glm::dvec3& origin, const glm::dvec3& dir,
-                                   IntersectionResult& res) const override;
+        // defined here so the scene can inline them, it calls them on the final type
+        virtual bool intersect_ray(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                                   IntersectionResult& res) const override {
+
+            auto tr_origin = world_to_local(origin);
+            auto tr_dir    = world_to_local_dir(dir);
+
+            Ray ray(tr_origin, tr_dir, 0, res.t);
+
+            TriangleBlockHit hit;
+
+            if (closest_hit(ray, hit)) {
+                res.hit    = true;
+                res.hitobj = (Object*)this;
+
+                res.t         = ray.tmax;
+                res.hitnormal = local_to_world_normal(hit_normal(hit));
+                res.hitpos    = origin + dir * ray.tmax;
+
+                return true;
+            }
+
+            return false;
+        }
+
+        virtual bool occluded(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                              Real tmax) const override {
+            auto tr_origin = world_to_local(origin);
+            auto tr_dir    = world_to_local_dir(dir);
+
+            return any_hit(Ray(tr_origin, tr_dir, 0, tmax));
+        }
+
+        virtual void intersect_packet(const Ray* rays, uint32_t mask,
+                                      IntersectionResult* results) const override;
 
         virtual BoundingBox bbox() const override {
-            assert(m_bvh != nullptr);
-            return get_transformed_bbox(m_bvh->bbox, m_transform);
+            assert(!m_tree.empty());
+            return get_transformed_bbox(m_tree.bvh.bbox, m_transform);
         }
 
         virtual BoundingBox local_bbox() const override {
-            assert(m_bvh != nullptr);
-            return m_bvh->bbox;
+            assert(!m_tree.empty());
+            return m_tree.bvh.bbox;
         }
 
         virtual BoundingSphere bsphere() const override {
-            assert(m_bvh != nullptr);
-            auto bsphere = m_bvh->bsphere;
-            return {local_to_world(bsphere.first), bsphere.second};
+            assert(!m_tree.empty());
+            return get_transformed_bsphere(m_tree.bvh.bsphere, m_transform);
         }
 
         virtual BoundingSphere local_bsphere() const override {
-            assert(m_bvh != nullptr);
-            return m_bvh->bsphere;
+            assert(!m_tree.empty());
+            return m_tree.bvh.bsphere;
         }
 
         virtual bool setup() override;
 
+        void set_bvh_params(const BVHBuildParams& params) { m_bvh_params = params; }
+
+        const auto& bvh_report() const { return m_tree.report; }
+
+        // passes 0 if the build was not optimized
+        const auto& optimize_report() const { return m_tree.optimize_report; }
+
+        auto num_triangles() const { return m_tree.num_primitives; }
+
+        // runtime memory of the blocks and nodes, averaged over the triangles
+        double memory_per_triangle() const {
+            return m_tree.num_primitives != 0
+                       ? (double)m_tree.memory_usage() / m_tree.num_primitives
+                       : 0.0;
+        }
+
+        // closest hit in the space of the mesh at either precision, shrinks ray.tmax to the hit.
+        // intersect_ray and occluded go through these with the precision of the build
+        template <typename R>
+        bool closest_hit(RayT<R>& ray, TriangleBlockHit& hit) const {
+            m_tree.traverse(m_bvh_params.layout, ray,
+                            closest_hit_leaf_blocks(m_tree.blocks, ray, hit));
+            return hit.hit();
+        }
+
+        template <typename R>
+        bool any_hit(RayT<R> ray) const {
+            return m_tree.traverse(m_bvh_params.layout, ray,
+                                   any_hit_leaf_blocks(m_tree.blocks, ray));
+        }
+
+        // closest hits for a packet of rays in the space of the mesh, hits[i] for rays[i]. walks
+        // the binary tree the wide layouts are collapsed from, the compressed layout does not
+        // keep it so its rays are traced one by one
+        template <typename R>
+        void closest_hit_packet(RayT<R>* rays, int count, TriangleBlockHit* hits) const {
+            if (m_tree.bvh.empty()) {
+                for (int i = 0; i < count; i++)
+                    closest_hit(rays[i], hits[i]);
+
+                return;
+            }
+
+            const auto& blocks = m_tree.blocks;
+
+            ray_packet_traverse(
+                m_tree.bvh.nodes, rays, count,
+                [&](uint32_t mask, uint32_t offset, uint16_t num_triangles) {
+                    for (; mask != 0; mask &= mask - 1) {
+                        auto i = __builtin_ctz(mask);
+                        closest_hit_leaf_blocks(blocks, rays[i], hits[i])(offset, num_triangles);
+                    }
+                },
+                [&](int i) { return closest_hit_leaf_blocks(blocks, rays[i], hits[i]); });
+        }
+
+        glm::dvec3 hit_normal(const TriangleBlockHit& hit) const {
+            return m_tree.blocks[hit.block].normal(hit.lane);
+        }
+
+        // meshes loaded from a file keep their built bvh in this directory, keyed by the file
+        // contents and build parameters. an empty path disables the cache
+        void set_cache_dir(const std::string& dir) { m_cache_dir = dir; }
+
+    private:
+        bool load_cache(const std::string& path, uint64_t key);
+        void save_cache(const std::string& path, uint64_t key) const;
+
+        void print_report(const char* source) const;
+
     private:
         bool m_errored;
 
-        UnoptimizedBVHNode<Triangle>* m_bvh;
-        std::vector<Triangle>         m_triangles;
+        std::string m_filename;
+        std::string m_cache_dir = ".bvhcache";
+
+        BVHBuildParams m_bvh_params;
+
+        std::vector<Triangle> m_triangles; // build input, released once setup is done
+
+        AcceleratorTree<Triangle, TriangleBlock<triangle_block_width>> m_tree;
     };
 
 } // namespace Oxy::Renderer
@@ -0,0 +1,34 @@
+#include "renderer/geometry/primitive_group.hpp"
+
+#include <iostream>
+#include <sstream>
+
+namespace Oxy::Renderer {
+
+    bool PrimitiveGroup::setup() {
+        // the primitives are released by the build, there is nothing to rebuild from
+        if (!m_accel.empty())
+            return true;
+
+        m_accel.build(m_bvh_params);
+
+        if (m_accel.empty())
+            return false;
+
+        std::ostringstream report;
+        report << "primitives: " << m_accel.num_triangles() << " triangles, "
+               << m_accel.num_spheres() << " spheres, "
+               << m_accel.memory_usage() / (1024.0 * 1024.0) << " MB\n";
+
+        if (m_accel.num_triangles() != 0)
+            report << "  triangles " << m_accel.triangle_report() << "\n";
+
+        if (m_accel.num_spheres() != 0)
+            report << "  spheres " << m_accel.sphere_report() << "\n";
+
+        std::cout << report.str();
+
+        return true;
+    }
+
+} // namespace Oxy::Renderer
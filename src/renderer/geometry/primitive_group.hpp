@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+
+#include "renderer/geometry/object.hpp"
+
+#include "renderer/accel/accelerator.hpp"
+
+namespace Oxy::Renderer {
+
+    // an object made straight from primitives, triangles and analytic spheres in one
+    // Accelerator. meant for point clouds drawn as spheres, which would take dozens of
+    // triangles each once tessellated
+    class PrimitiveGroup final : public Object {
+    public:
+        PrimitiveGroup() = default;
+
+        PrimitiveGroup(const std::vector<Triangle>& triangles, const std::vector<Sphere>& spheres) {
+            m_accel.add_triangles(triangles);
+            m_accel.add_spheres(spheres);
+        }
+
+        void add_triangles(const std::vector<Triangle>& triangles) {
+            m_accel.add_triangles(triangles);
+        }
+
+        void add_spheres(const std::vector<Sphere>& spheres) { m_accel.add_spheres(spheres); }
+
+        virtual bool intersect_ray(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                                   IntersectionResult& res) const override {
+
+            auto tr_origin = world_to_local(origin);
+            auto tr_dir    = world_to_local_dir(dir);
+
+            Ray ray(tr_origin, tr_dir, 0, res.t);
+
+            AcceleratorHit hit;
+
+            if (m_accel.closest_hit(ray, hit)) {
+                res.hit    = true;
+                res.hitobj = (Object*)this;
+
+                res.t         = ray.tmax;
+                res.hitnormal = local_to_world_normal(m_accel.hit_normal(hit, ray.at(ray.tmax)));
+                res.hitpos    = origin + dir * ray.tmax;
+
+                return true;
+            }
+
+            return false;
+        }
+
+        virtual bool occluded(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                              Real tmax) const override {
+            auto tr_origin = world_to_local(origin);
+            auto tr_dir    = world_to_local_dir(dir);
+
+            return m_accel.any_hit(Ray(tr_origin, tr_dir, 0, tmax));
+        }
+
+        virtual BoundingBox bbox() const override {
+            return get_transformed_bbox(m_accel.bbox(), m_transform);
+        }
+
+        virtual BoundingBox local_bbox() const override { return m_accel.bbox(); }
+
+        virtual BoundingSphere bsphere() const override {
+            return get_transformed_bsphere(m_accel.bsphere(), m_transform);
+        }
+
+        virtual BoundingSphere local_bsphere() const override { return m_accel.bsphere(); }
+
+        virtual bool setup() override;
+
+        void set_bvh_params(const BVHBuildParams& params) { m_bvh_params = params; }
+
+        const auto& accelerator() const { return m_accel; }
+
+    private:
+        BVHBuildParams m_bvh_params;
+        Accelerator    m_accel;
+    };
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <variant>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "renderer/utils/intersection_result.hpp"
+#include "renderer/utils/ray.hpp"
+
+#include "renderer/accel/bvh.hpp"
+#include "renderer/accel/primitive_traits.hpp"
+#include "renderer/accel/ray_packet.hpp"
+#include "renderer/accel/wide_bvh.hpp"
+
+#include "renderer/geometry/instance_set.hpp"
+#include "renderer/geometry/mesh.hpp"
+#include "renderer/geometry/primitive_group.hpp"
+
+namespace Oxy::Renderer {
+
+    // the scene only holds these object types. every call through a scene object is resolved
+    // with std::visit against a final class, so the leaf loops of the scene bvh make no
+    // virtual calls and can inline the intersection code
+    using SceneObjectVariant = std::variant<Mesh*, InstanceSet*, PrimitiveGroup*>;
+
+    // entry of the scene bvh: the object together with its world bounds, which are cached so
+    // neither a build nor a refit has to transform the local bounds again. update_bounds has
+    // to be called once the object is set up and whenever its transform changes
+    struct SceneObject {
+        template <typename T>
+        SceneObject(T* obj)
+            : object(obj) {}
+
+        template <typename Fn>
+        decltype(auto) visit(Fn&& fn) const {
+            return std::visit(fn, object);
+        }
+
+        Object* base() const {
+            return visit([](auto obj) -> Object* { return obj; });
+        }
+
+        void update_bounds() {
+            visit([this](auto obj) {
+                bbox    = obj->bbox();
+                bsphere = obj->bsphere();
+            });
+
+            centroid = 0.5 * (bbox.first + bbox.second);
+        }
+
+        SceneObjectVariant object;
+
+        BoundingBox    bbox = empty_bbox();
+        BoundingSphere bsphere;
+        glm::dvec3     centroid{};
+    };
+
+    template <>
+    inline BoundingBox PrimitiveTraits::bbox(const SceneObject& obj) {
+        return obj.bbox;
+    }
+
+    template <>
+    inline BoundingSphere PrimitiveTraits::bsphere(const SceneObject& obj) {
+        return obj.bsphere;
+    }
+
+    template <>
+    inline glm::dvec3 PrimitiveTraits::midpoint(const SceneObject& obj) {
+        return obj.centroid;
+    }
+
+    inline auto closest_hit_leaf_objects(const std::vector<SceneObject>& primitives, Ray& ray,
+                                         IntersectionResult& res) {
+        return [&](uint32_t offset, uint16_t count) {
+            auto begin = primitives.begin() + offset;
+
+            for (auto it = begin; it != begin + count; it++) {
+                it->visit([&](auto obj) {
+                    IntersectionResult it_res;
+                    it_res.t = ray.tmax;
+
+                    if (obj->intersect_ray(ray.origin, ray.dir, it_res)) {
+                        if (it_res.t < ray.tmax) {
+                            ray.tmax = it_res.t;
+                            res      = it_res;
+
+                            res.hitobj = obj;
+                        }
+                    }
+                });
+            }
+
+            return false;
+        };
+    }
+
+    inline auto any_hit_leaf_objects(const std::vector<SceneObject>& primitives, const Ray& ray) {
+        return [&](uint32_t offset, uint16_t count) {
+            auto begin = primitives.begin() + offset;
+
+            for (auto it = begin; it != begin + count; it++) {
+                auto hit = it->visit(
+                    [&](auto obj) { return obj->occluded(ray.origin, ray.dir, ray.tmax); });
+
+                if (hit)
+                    return true;
+            }
+
+            return false;
+        };
+    }
+
+    // packet version of closest_hit_leaf_objects, every object of the leaf gets the rays that
+    // reached it in one intersect_packet call
+    inline auto closest_hit_packet_leaf_objects(const std::vector<SceneObject>& primitives,
+                                                Ray* rays, IntersectionResult* results) {
+        return [&primitives, rays, results](uint32_t mask, uint32_t offset, uint16_t count) {
+            auto begin = primitives.begin() + offset;
+
+            for (auto it = begin; it != begin + count; it++) {
+                IntersectionResult it_results[ray_packet_size];
+
+                for (auto bits = mask; bits != 0; bits &= bits - 1)
+                    it_results[__builtin_ctz(bits)].t = rays[__builtin_ctz(bits)].tmax;
+
+                auto obj = it->visit([&](auto obj) -> Object* {
+                    obj->intersect_packet(rays, mask, it_results);
+                    return obj;
+                });
+
+                for (auto bits = mask; bits != 0; bits &= bits - 1) {
+                    auto i = __builtin_ctz(bits);
+
+                    if (it_results[i].hit && it_results[i].t < rays[i].tmax) {
+                        rays[i].tmax = it_results[i].t;
+                        results[i]   = it_results[i];
+
+                        results[i].hitobj = obj;
+                    }
+                }
+            }
+        };
+    }
+
+    inline bool finish_closest_hit_objects(const IntersectionResult& tmp_res,
+                                           IntersectionResult&       res) {
+        if (!tmp_res.hit)
+            return false;
+
+        res = tmp_res;
+
+        return true;
+    }
+
+    inline bool dumb_bvh_traverse_objects(const LinearBVH<SceneObject>&   bvh,
+                                          const std::vector<SceneObject>& primitives, Ray ray,
+                                          IntersectionResult& res) {
+        IntersectionResult tmp_res;
+
+        linear_bvh_traverse(bvh.nodes, ray, closest_hit_leaf_objects(primitives, ray, tmp_res));
+
+        return finish_closest_hit_objects(tmp_res, res);
+    }
+
+    inline bool dumb_bvh_occluded_objects(const LinearBVH<SceneObject>&   bvh,
+                                          const std::vector<SceneObject>& primitives, Ray ray) {
+        return linear_bvh_traverse(bvh.nodes, ray, any_hit_leaf_objects(primitives, ray));
+    }
+
+    template <int N>
+    bool wide_bvh_traverse_objects(const WideBVH<SceneObject, N>&  bvh,
+                                   const std::vector<SceneObject>& primitives, Ray ray,
+                                   IntersectionResult& res) {
+        IntersectionResult tmp_res;
+
+        wide_bvh_traverse<N>(bvh.nodes, ray, closest_hit_leaf_objects(primitives, ray, tmp_res));
+
+        return finish_closest_hit_objects(tmp_res, res);
+    }
+
+    template <int N>
+    bool wide_bvh_occluded_objects(const WideBVH<SceneObject, N>&  bvh,
+                                   const std::vector<SceneObject>& primitives, Ray ray) {
+        return wide_bvh_traverse<N>(bvh.nodes, ray, any_hit_leaf_objects(primitives, ray));
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,101 @@
+#include "renderer/render_workers.hpp"
+
+namespace Oxy::Renderer {
+
+    RenderWorkers::~RenderWorkers() {
+        set_state(WorkerState::Stopped);
+
+        for (auto& thread : m_threads)
+            if (thread.joinable())
+                thread.join();
+    }
+
+    void RenderWorkers::resize(unsigned int num_workers) {
+        while (m_threads.size() < num_workers) {
+            auto id = (int)m_threads.size();
+
+            auto& worker_state = m_worker_states.emplace_back(m_state.load());
+            m_threads.push_back(
+                std::thread(&RenderWorkers::worker_func, this, id, std::ref(worker_state)));
+        }
+    }
+
+    void RenderWorkers::resume() { set_state(WorkerState::Rendering); }
+
+    void RenderWorkers::pause() { set_state(WorkerState::Paused); }
+
+    void RenderWorkers::wait_idle() {
+        std::unique_lock lk(m_mtx);
+        m_idle_cv.wait(lk, [this] { return m_active.load() == 0; });
+    }
+
+    // the epoch is bumped before the parked count is read, and a worker counts itself parked
+    // before it reads the epoch, so either the worker sees the new epoch or this sees the
+    // worker and takes the lock it waits under
+    void RenderWorkers::notify() {
+        m_epoch.fetch_add(1);
+
+        if (m_parked.load() == 0)
+            return;
+
+        { std::lock_guard lk(m_mtx); }
+
+        m_wake_cv.notify_all();
+    }
+
+    void RenderWorkers::set_state(WorkerState state) {
+        {
+            std::lock_guard lk(m_mtx);
+            m_state.store(state);
+            m_epoch.fetch_add(1);
+        }
+
+        m_wake_cv.notify_all();
+    }
+
+    void RenderWorkers::worker_func(int id, std::atomic<WorkerState>& worker_state) {
+        while (true) {
+            auto epoch = m_epoch.load();
+            auto state = m_state.load();
+
+            worker_state.store(state, std::memory_order_relaxed);
+
+            if (state == WorkerState::Stopped)
+                return;
+
+            if (state == WorkerState::Paused) {
+                std::unique_lock lk(m_mtx);
+                m_wake_cv.wait(lk, [this] { return m_state.load() != WorkerState::Paused; });
+
+                continue;
+            }
+
+            // counted active before the state is checked again, so wait_idle either sees
+            // this worker or this worker sees the pause
+            m_active.fetch_add(1);
+
+            auto did_work = m_state.load() == WorkerState::Rendering && m_job(id);
+
+            if (m_active.fetch_sub(1) == 1 && m_state.load() != WorkerState::Rendering) {
+                { std::lock_guard lk(m_mtx); }
+
+                m_idle_cv.notify_all();
+            }
+
+            if (did_work)
+                continue;
+
+            m_parked.fetch_add(1);
+
+            {
+                std::unique_lock lk(m_mtx);
+                m_wake_cv.wait(lk, [&] {
+                    return m_epoch.load() != epoch || m_state.load() != WorkerState::Rendering;
+                });
+            }
+
+            m_parked.fetch_sub(1);
+        }
+    }
+
+} // namespace Oxy::Renderer
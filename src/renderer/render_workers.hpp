@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Oxy::Renderer {
+
+    enum class WorkerState {
+        Rendering,
+        Paused,
+        Stopped,
+    };
+
+    // long lived render threads that run job(worker) over and over while rendering. a job
+    // returns false when it found nothing to do, the worker then parks until notify() or a
+    // state change instead of spinning. threads are only added, pausing keeps them parked
+    // and only the destructor joins them
+    class RenderWorkers final {
+    public:
+        using Job = std::function<bool(int worker)>;
+
+        RenderWorkers(Job job)
+            : m_job(std::move(job)) {}
+
+        ~RenderWorkers();
+
+        RenderWorkers(const RenderWorkers&) = delete;
+        RenderWorkers& operator=(const RenderWorkers&) = delete;
+
+        // grows the pool to num_workers threads, it never shrinks
+        void resize(unsigned int num_workers);
+
+        void resume();
+
+        // workers finish the job they are in, then park until resume()
+        void pause();
+
+        // returns once no worker is inside a job, only meaningful while paused
+        void wait_idle();
+
+        // there may be new work, wakes the workers parked after finding none
+        void notify();
+
+        auto size() const { return m_threads.size(); }
+
+        WorkerState worker_state(int id) const {
+            return m_worker_states[id].load(std::memory_order_relaxed);
+        }
+
+    private:
+        void set_state(WorkerState state);
+        void worker_func(int id, std::atomic<WorkerState>& worker_state);
+
+    private:
+        Job m_job;
+
+        std::atomic<WorkerState> m_state = WorkerState::Paused;
+
+        // bumped by notify, a worker that found nothing only parks if it has not moved since
+        std::atomic<uint64_t> m_epoch  = 0;
+        std::atomic<int>      m_parked = 0;
+        std::atomic<int>      m_active = 0; // workers inside a job
+
+        std::mutex              m_mtx;
+        std::condition_variable m_wake_cv;
+        std::condition_variable m_idle_cv;
+
+        std::vector<std::thread> m_threads;
+
+        // a deque so the entries handed to the workers stay put while the pool grows
+        std::deque<std::atomic<WorkerState>> m_worker_states;
+    };
+
+} // namespace Oxy::Renderer
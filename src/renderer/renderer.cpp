@@ -1,14 +1,15 @@
 #include "renderer/renderer.hpp"
 
+#include "renderer/geometry/instance_set.hpp"
 #include "renderer/geometry/mesh.hpp"
-#include "renderer/geometry/mesh_instance.hpp"
 
 namespace Oxy::Renderer {
 
     OxyRenderer::OxyRenderer()
         : m_scene(m_ctx)
         , m_running(false)
-        , m_state(WorkerState::Stopped) {
+        , m_state(WorkerState::Stopped)
+        , m_workers([this](int worker) { return render_next(worker); }) {
 
         auto model = new Mesh("./bunny.stl");
 
@@ -17,14 +18,16 @@ namespace Oxy::Renderer {
         m_scene.add_object(model);
 
         /*
+        auto instances = new InstanceSet();
+
         for (int y = -200; y < 200; y += 100) {
             for (int x = -200; x < 200; x += 100) {
-                auto instance = new MeshInstance(model);
-                instance->set_transform(glm::translate(glm::dmat4(1.0), glm::dvec3(x, y, 0.0)));
-                m_scene.add_object(instance);
+                auto offset = glm::translate(glm::dmat4(1.0), glm::dvec3(x, y, 0.0));
+                instances->add_instance(model, offset * model_transform);
             }
         }
-        model->setup();
+
+        m_scene.add_object(instances);
         */
 
         m_scene.setup();
@@ -34,81 +37,126 @@ namespace Oxy::Renderer {
         camera().aim(glm::dvec3(0, -50, 60));
 
         m_film.clear();
+
+        update_pass_limit();
     }
 
+    // the film and the tiles are replaced under the workers, they are parked until it is done
     void OxyRenderer::set_render_resolution(int width, int height) {
+        auto running = m_running;
+
+        m_workers.pause();
+        m_workers.wait_idle();
+
         m_ctx.width  = width;
         m_ctx.height = height;
         m_film.resize(width, height);
+
+        // the same tiles every pass, only a new resolution changes them
+        m_tiles.resize(m_film.width(), m_film.height());
+        m_samples_shown = 0;
+
+        if (running)
+            m_workers.resume();
     }
 
     void OxyRenderer::select_integrator() {}
 
     void OxyRenderer::start_render(unsigned int num_threads) {
-        if (!m_continous_sampling && m_samples_done > m_samples_to_do)
+        // objects moved since the last start are refitted while no worker traces, the
+        // samples taken before the move no longer match the scene
+        m_workers.pause();
+        m_workers.wait_idle();
+
+        if (m_scene.update()) {
+            m_film.clear();
+            m_tiles.reset();
+            m_samples_shown = 0;
+        }
+
+        if (!m_continous_sampling && samples_done() >= m_samples_to_do) {
+            if (m_running)
+                pause_render();
+
             return;
+        }
 
         m_running = true;
         m_state   = WorkerState::Rendering;
 
-        for (unsigned int i = 0; i < m_worker_state.size(); i++)
-            m_worker_state[i] = WorkerState::Rendering;
-
-        if (num_threads > m_workers.size()) {
-            for (unsigned int i = m_worker_state.size(); i < num_threads; i++) {
-                auto id = m_workers.size();
-
-                auto worker_func = [&](int id) -> void {
-                    while (true) {
-                        auto state = this->worker_state(id);
-                        if (state == WorkerState::Stopped)
-                            break;
-
-                        if (state == WorkerState::Rendering)
-                            if (auto block = this->aquire_block(); block.has_value())
-                                this->render_block(block.value());
-
-                        if (state == WorkerState::Paused) {
-                            using namespace std::chrono_literals;
-                            std::this_thread::sleep_for(10ms);
-                        }
-                        else
-                            std::this_thread::yield();
-                    }
-                };
+        // the pass already dealt is stolen from, the next ones include the new workers
+        m_workers.resize(num_threads);
+        m_tiles.set_num_workers((int)m_workers.size());
 
-                m_worker_state.push_back(WorkerState::Rendering);
-                m_workers.push_back(std::thread(worker_func, id));
-            }
-        }
+        m_workers.resume();
     }
 
     void OxyRenderer::pause_render() {
         m_running = false;
         m_state   = WorkerState::Paused;
 
-        for (unsigned int i = 0; i < m_worker_state.size(); i++)
-            m_worker_state[i] = WorkerState::Paused;
+        m_workers.pause();
     }
 
+    // the threads stay parked, only the blocks in flight are waited for
     void OxyRenderer::reset_render() {
         m_running = false;
         m_state   = WorkerState::Stopped;
 
-        for (unsigned int i = 0; i < m_worker_state.size(); i++)
-            m_worker_state[i] = WorkerState::Stopped;
+        m_workers.pause();
+        m_workers.wait_idle();
 
-        for (auto& thread : m_workers)
-            if (thread.joinable())
-                thread.join();
+        m_film.clear();
 
-        m_worker_state.clear();
-        m_workers.clear();
+        m_tiles.reset();
+        m_samples_shown = 0;
+    }
 
-        m_film.clear();
+    void OxyRenderer::set_sampler(SamplerType type) {
+        if (type == m_sampler.type())
+            return;
+
+        auto running = m_running;
+
+        reset_render();
+
+        // the blue noise mask is built here rather than stalling the first worker to use it
+        if (type == SamplerType::BlueNoise)
+            blue_noise_mask();
+
+        m_sampler = Sampler(type, m_sampler.seed());
+
+        if (running)
+            start_render((unsigned int)m_workers.size());
+    }
+
+    void OxyRenderer::render_block_packets(Block block, uint32_t sample) {
+        for (int tile_y = block.start_y; tile_y < block.end_y; tile_y += ray_packet_tile)
+            for (int tile_x = block.start_x; tile_x < block.end_x; tile_x += ray_packet_tile) {
+                CameraRay rays[ray_packet_size];
+                Color     samples[ray_packet_size];
+                int       pixel_x[ray_packet_size], pixel_y[ray_packet_size];
+                int       count = 0;
+
+                auto end_y = std::min(tile_y + ray_packet_tile, block.end_y);
+                auto end_x = std::min(tile_x + ray_packet_tile, block.end_x);
+
+                for (int y = tile_y; y < end_y; y++)
+                    for (int x = tile_x; x < end_x; x++) {
+                        auto pixel = m_sampler.pixel(x, y, sample);
+
+                        rays[count]    = m_camera.get_ray(x, y, m_film.width(), m_film.height(),
+                                                          pixel.get_2d());
+                        pixel_x[count] = x;
+                        pixel_y[count] = y;
+                        count++;
+                    }
+
+                m_scene.get_sample_packet(rays, count, samples);
 
-        m_blocks.clear();
-        m_samples_done = 0;
+                for (int i = 0; i < count; i++)
+                    m_film.splat(pixel_x[i], pixel_y[i], samples[i]);
+            }
     }
 
     const char* OxyRenderer::state_str() const {
@@ -120,24 +168,18 @@ namespace Oxy::Renderer {
         return "";
     }
 
-    void OxyRenderer::next_sample() {
-        if (has_block())
-            return;
-
-        if (!m_continous_sampling && m_samples_done >= m_samples_to_do)
-            pause_render();
+    bool OxyRenderer::poll_progress() {
+        auto done = samples_done();
 
-        std::lock_guard g(m_blocks_mtx);
+        if (done == m_samples_shown)
+            return false;
 
-        m_blocks.clear();
+        m_samples_shown = done;
 
-        for (int y = 0; y < m_film.height(); y += 32)
-            for (int x = 0; x < m_film.width(); x += 32) {
-                m_blocks.push_back(Block{x, y, std::min(m_film.width(), x + 32),
-                                         std::min(m_film.height(), y + 32)});
-            }
+        if (m_running && !m_continous_sampling && done >= m_samples_to_do)
+            pause_render();
 
-        m_samples_done++;
+        return true;
     }
 
 } // namespace Oxy::Renderer
@@ -2,29 +2,19 @@
 
 #include <chrono>
 #include <iostream>
-#include <mutex>
+#include <limits>
 #include <optional>
-#include <thread>
-#include <vector>
 
 #include "renderer/context.hpp"
+#include "renderer/render_workers.hpp"
 #include "renderer/scene.hpp"
+#include "renderer/tile_scheduler.hpp"
 
 #include "renderer/utils/sample_film.hpp"
+#include "renderer/utils/sampler.hpp"
 
 namespace Oxy::Renderer {
 
-    struct Block {
-        int start_x, start_y;
-        int end_x, end_y;
-    };
-
-    enum class WorkerState {
-        Rendering,
-        Paused,
-        Stopped,
-    };
-
     class OxyRenderer final {
     public:
         OxyRenderer();
@@ -40,19 +30,39 @@ namespace Oxy::Renderer {
         void pause_render();
         void reset_render();
 
-        void sample_continously(bool on) { m_continous_sampling = on; }
-        void set_max_samples(int num_samples) { m_samples_to_do = num_samples; }
+        void sample_continously(bool on) {
+            m_continous_sampling = on;
+            update_pass_limit();
+        }
+
+        void set_max_samples(int num_samples) {
+            m_samples_to_do = num_samples;
+            update_pass_limit();
+        }
+
+        // starts the image over unless the sampler is the same, samples of different
+        // sequences would not stratify together
+        void set_sampler(SamplerType type);
 
-        const auto samples_done() const { return m_samples_done - 1; }
+        // trace primary rays as packets of ray_packet_tile x ray_packet_tile pixels
+        void set_packet_tracing(bool on) { m_packet_tracing = on; }
+
+        // passes whose every tile has been rendered
+        int samples_done() const { return (int)m_tiles.passes_completed(); }
 
         float last_sample_time() const;
         float avg_sample_time() const;
 
-        void next_sample();
-        bool has_block() const { return m_blocks.size() > 0; }
+        // polled by the ui, the workers start the passes themselves and do not wait on it.
+        // pauses once the last pass has completed, returns whether one completed since the
+        // last call
+        bool poll_progress();
 
         const auto& film() const { return m_film; }
-        const auto& blocks() const { return m_blocks; }
+        const auto& blocks() const { return m_tiles.tiles(); }
+
+        // claim counters over the whole session, to see whether workers wait on each other
+        auto tile_stats() const { return m_tiles.stats(); }
 
         auto& camera() { return m_camera; }
         auto& scene() { return m_scene; }
@@ -61,38 +71,71 @@ namespace Oxy::Renderer {
         const char* state_str() const;
         const auto  running() const { return m_running; }
 
-        WorkerState worker_state(int id) const { return m_worker_state[id]; }
+        WorkerState worker_state(int id) const { return m_workers.worker_state(id); }
 
     private:
-        std::optional<Block> aquire_block() {
-            std::lock_guard g(m_blocks_mtx);
+        std::optional<Tile> aquire_block(int worker) { return m_tiles.claim(worker); }
 
-            if (m_blocks.size() == 0)
-                return std::nullopt;
+        // a raised limit may let the parked workers start the next pass
+        void update_pass_limit() {
+            m_tiles.set_pass_limit(m_continous_sampling ? std::numeric_limits<uint32_t>::max()
+                                                        : (uint32_t)m_samples_to_do);
+            m_workers.notify();
+        }
+
+        // the job of the render workers, false when there was nothing to claim. whatever the
+        // claim or the block changed in the scheduler may have made work for parked workers
+        bool render_next(int worker) {
+            auto events = m_tiles.work_events();
+            auto tile   = aquire_block(worker);
+
+            if (tile.has_value())
+                render_tile(tile.value());
+
+            if (m_tiles.work_events() != events)
+                m_workers.notify();
+
+            return tile.has_value();
+        }
+
+        // times the block, the scheduler deals the next passes by what the tiles cost
+        void render_tile(const Tile& tile) {
+            auto start = std::chrono::steady_clock::now();
 
-            auto first = m_blocks.front();
-            m_blocks.erase(m_blocks.begin());
+            // the pass is the sample index, whichever worker renders the block
+            render_block(tile.block, tile.pass - 1);
 
-            return first;
+            m_tiles.finish(tile, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - start));
         }
 
-        void render_block(Block block) {
+        void render_block(Block block, uint32_t sample) {
+            if (m_packet_tracing) {
+                render_block_packets(block, sample);
+                return;
+            }
+
             for (int y = block.start_y; y < block.end_y; y++)
                 for (int x = block.start_x; x < block.end_x; x++) {
-                    auto camray = m_camera.get_ray(x, y, m_film.width(), m_film.height());
+                    auto pixel  = m_sampler.pixel(x, y, sample);
+                    auto camray = m_camera.get_ray(x, y, m_film.width(), m_film.height(),
+                                                   pixel.get_2d());
+
                     m_film.splat(x, y, m_scene.get_sample(camray));
                 }
         }
 
+        void render_block_packets(Block block, uint32_t sample);
+
     private:
         RenderContext m_ctx;
 
         Camera     m_camera;
+        Sampler    m_sampler;
         SampleFilm m_film;
         Scene      m_scene;
 
-        std::vector<Block> m_blocks;
-        std::mutex         m_blocks_mtx;
+        TileScheduler m_tiles;
 
         std::chrono::duration<double> m_last_sample_time;
         std::chrono::duration<double> m_avg_sample_time;
@@ -100,12 +143,13 @@ namespace Oxy::Renderer {
         bool        m_running;
         WorkerState m_state;
 
-        int  m_samples_done       = 0;
+        int  m_samples_shown      = 0; // completed passes poll_progress has reported
         int  m_samples_to_do      = 1;
         bool m_continous_sampling = false;
+        bool m_packet_tracing     = true;
 
-        std::vector<std::thread> m_workers;
-        std::vector<WorkerState> m_worker_state;
+        // last, so the threads are joined before anything they render with is destroyed
+        RenderWorkers m_workers;
     };
 
 } // namespace Oxy::Renderer
@@ -1,53 +1,222 @@
 #include "renderer/scene.hpp"
 
+#include <algorithm>
+
+#include "renderer/utils/thread_pool.hpp"
+
 #define USE_SCENE_BVH 1
 
 namespace Oxy::Renderer {
 
     Scene::~Scene() {
-        for (auto obj : m_objects)
-            delete obj;
+        for (const auto& obj : m_objects)
+            delete obj.base();
+    }
+
+    bool Scene::intersect_ray(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                              IntersectionResult& res) const {
+#if USE_SCENE_BVH == 0
+        for (const auto& scene_obj : m_objects) {
+            scene_obj.visit([&](auto obj) {
+                IntersectionResult obj_res;
+                obj_res.t = res.t;
 
-        if (m_bvh != nullptr)
-            delete m_bvh;
+                if (obj->intersect_ray(origin, dir, obj_res)) {
+                    if (obj_res.t < res.t)
+                        res = obj_res;
+                }
+            });
+        }
+
+        return res.hit;
+#else
+        Ray ray(origin, dir, 0, res.t);
+
+        switch (m_bvh_params.layout) {
+        case BVHLayout::Binary: return dumb_bvh_traverse_objects(m_bvh, m_objects, ray, res);
+        case BVHLayout::Wide4: return wide_bvh_traverse_objects(m_bvh4, m_objects, ray, res);
+        case BVHLayout::Wide8:
+        case BVHLayout::Compressed: return wide_bvh_traverse_objects(m_bvh8, m_objects, ray, res);
+        }
+
+        return false;
+#endif
+    }
+
+    bool Scene::occluded(const Vec3<Real>& origin, const Vec3<Real>& dir, Real tmax) const {
+#if USE_SCENE_BVH == 0
+        for (const auto& scene_obj : m_objects) {
+            auto hit = scene_obj.visit([&](auto obj) { return obj->occluded(origin, dir, tmax); });
+
+            if (hit)
+                return true;
+        }
+
+        return false;
+#else
+        Ray ray(origin, dir, 0, tmax);
+
+        switch (m_bvh_params.layout) {
+        case BVHLayout::Binary: return dumb_bvh_occluded_objects(m_bvh, m_objects, ray);
+        case BVHLayout::Wide4: return wide_bvh_occluded_objects(m_bvh4, m_objects, ray);
+        case BVHLayout::Wide8:
+        case BVHLayout::Compressed: return wide_bvh_occluded_objects(m_bvh8, m_objects, ray);
+        }
+
+        return false;
+#endif
+    }
+
+    void Scene::intersect_packet(Ray* rays, int count, IntersectionResult* results) const {
+#if USE_SCENE_BVH == 0
+        for (int i = 0; i < count; i++) {
+            results[i].t = rays[i].tmax;
+            intersect_ray(rays[i].origin, rays[i].dir, results[i]);
+        }
+#else
+        ray_packet_traverse(
+            m_bvh.nodes, rays, count, closest_hit_packet_leaf_objects(m_objects, rays, results),
+            [&](int i) { return closest_hit_leaf_objects(m_objects, rays[i], results[i]); });
+#endif
     }
 
     Color Scene::get_sample(CameraRay ray) {
         IntersectionResult res;
 
-#if USE_SCENE_BVH == 0
-        for (auto obj : m_objects) {
-            IntersectionResult obj_res;
+        if (intersect_ray(ray.origin, ray.dir, res))
+            return shade(ray, res);
+
+        return Color();
+    }
 
-            auto tr_origin = obj->world_to_local(ray.origin);
-            auto tr_dir    = obj->world_to_local_dir(ray.dir);
+    void Scene::get_sample_packet(const CameraRay* camera_rays, int count, Color* samples) {
+        Ray                rays[ray_packet_size];
+        IntersectionResult results[ray_packet_size];
+
+        for (int i = 0; i < count; i++)
+            rays[i] = Ray(camera_rays[i].origin, camera_rays[i].dir);
+
+        intersect_packet(rays, count, results);
+
+        for (int i = 0; i < count; i++)
+            samples[i] = results[i].hit ? shade(camera_rays[i], results[i]) : Color();
+    }
 
-            if (obj->intersect_ray(tr_origin, tr_dir, obj_res)) {
-                if (obj_res.t < res.t)
-                    res = obj_res;
+    Color Scene::shade(const CameraRay& ray, const IntersectionResult& res) const {
+        return Color(-glm::dot(res.hitnormal, ray.dir));
+    }
+
+    void Scene::setup() {
+        // instance sets set up the meshes they place, which may also be in the scene or in
+        // another set. every mesh is set up once before the sets, the sets then find them
+        // done, a mesh set up by two threads at once would race with itself
+        std::vector<Mesh*>   meshes;
+        std::vector<Object*> others;
+
+        for (const auto& scene_obj : m_objects) {
+            if (auto mesh = std::get_if<Mesh*>(&scene_obj.object)) {
+                meshes.push_back(*mesh);
+                continue;
             }
+
+            if (auto set = std::get_if<InstanceSet*>(&scene_obj.object))
+                meshes.insert(meshes.end(), (*set)->meshes().begin(), (*set)->meshes().end());
+
+            others.push_back(scene_obj.base());
+        }
+
+        std::sort(meshes.begin(), meshes.end());
+        meshes.erase(std::unique(meshes.begin(), meshes.end()), meshes.end());
+
+        // objects are independent so they are set up concurrently, their own bvh builds fork
+        // onto the same pool so a single big mesh still gets every core
+        {
+            TaskGroup tasks;
+
+            for (auto mesh : meshes)
+                tasks.run([mesh] { mesh->setup(); });
+
+            tasks.wait();
         }
 
-        if (res.hit) {
-            return Color(-glm::dot(res.hitnormal, ray.dir));
+        {
+            TaskGroup tasks;
+
+            for (auto obj : others)
+                tasks.run([obj] { obj->setup(); });
+
+            tasks.wait();
         }
-#else
-        if (dumb_bvh_traverse_objectptr(m_bvh, m_objects, ray.origin, ray.dir, res)) {
-            return Color(-glm::dot(res.hitnormal, res.hitobj->local_to_world_dir(ray.dir)));
+
+        build_bvh();
+    }
+
+    bool Scene::update() {
+        std::vector<uint32_t> changed;
+
+        for (uint32_t i = 0; i < m_objects.size(); i++) {
+            auto obj = m_objects[i].base();
+
+            if (obj->dirty()) {
+                changed.push_back(i);
+                obj->clear_dirty();
+
+                m_objects[i].update_bounds();
+            }
+        }
+
+        if (changed.empty())
+            return false;
+
+#if USE_SCENE_BVH == 1
+        refit_bvh(m_bvh, m_bvh_refit, m_objects, changed, m_bvh_params);
+
+        auto cost = m_bvh_refit.sah_cost(m_bvh.nodes, m_bvh_params);
+
+        if (m_bvh_params.refit_rebuild_ratio > 0.0 &&
+            cost > m_bvh_built_cost * m_bvh_params.refit_rebuild_ratio) {
+            build_bvh();
+            return true;
         }
+
+        m_bvh_report.sah_cost = cost;
+
+        collapse_wide_bvh();
 #endif
 
-        return Color();
+        return true;
     }
 
-    void Scene::setup() {
-        for (auto obj : m_objects) {
-            obj->setup();
+    void Scene::build_bvh() {
+        // the world bounds are transformed once here, the build and later refits only read
+        // the cached copies
+        for (auto& obj : m_objects) {
+            obj.base()->clear_dirty();
+            obj.update_bounds();
         }
 
 #if USE_SCENE_BVH == 1
-        m_bvh = build_bvh_generic<Object*>(m_objects, 0, m_objects.size());
+        m_bvh        = build_bvh_generic<SceneObject>(m_objects, 0, m_objects.size(),
+                                                      m_bvh_params);
+        m_bvh_report = compute_bvh_cost(m_bvh, m_bvh_params);
+        m_bvh_refit  = make_bvh_refit_state(m_bvh, m_objects.size(), m_bvh_params);
+
+        m_bvh_built_cost = m_bvh_report.sah_cost;
+
+        collapse_wide_bvh();
 #endif
     }
 
+    // the wide layouts are collapsed again after every refit, that is linear in the node
+    // count but needs no sorting or binning. the compressed layout would reorder the objects
+    // under the refit state, the scene tree is small so it uses the plain wide nodes
+    void Scene::collapse_wide_bvh() {
+        if (m_bvh_params.layout == BVHLayout::Wide4)
+            m_bvh4 = collapse_bvh<4>(m_bvh);
+
+        if (m_bvh_params.layout == BVHLayout::Wide8 ||
+            m_bvh_params.layout == BVHLayout::Compressed)
+            m_bvh8 = collapse_bvh<8>(m_bvh);
+    }
+
 } // namespace Oxy::Renderer
@@ -8,34 +8,77 @@
 #include "renderer/utils/camera.hpp"
 #include "renderer/utils/color.hpp"
 
-#include "renderer/geometry/object.hpp"
+#include "renderer/geometry/scene_object.hpp"
+
+#include "renderer/accel/bvh_refit.hpp"
 
 namespace Oxy::Renderer {
 
     class Scene {
     public:
         Scene(RenderContext& ctx)
-            : m_ctx(ctx)
-            , m_bvh(nullptr) {}
+            : m_ctx(ctx) {}
 
         ~Scene();
 
+        // T has to be one of the types in SceneObjectVariant
         template <typename T>
         void add_object(T* obj) {
-            m_objects.push_back((Object*)obj);
+            m_objects.emplace_back(obj);
         }
 
         auto num_objects() const { return m_objects.size(); }
 
         void setup();
 
+        // refits the bvh around objects whose transform changed since setup or the last
+        // update, rebuilding it instead once the tree has degraded too far. no rays may be
+        // traced while this runs. returns whether any object had moved
+        bool update();
+
+        bool intersect_ray(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                           IntersectionResult& res) const;
+
+        bool occluded(const Vec3<Real>& origin, const Vec3<Real>& dir,
+                      Real tmax = std::numeric_limits<Real>::max()) const;
+
+        // closest hits of up to ray_packet_size coherent rays traced together, results[i] for
+        // rays[i]. the tmax of every ray is its search limit and ends up at its hit distance
+        void intersect_packet(Ray* rays, int count, IntersectionResult* results) const;
+
+        void set_bvh_params(const BVHBuildParams& params) {
+            m_bvh_params = params;
+
+            // objects are owned and refitted by index, no leaf may share one with another
+            if (m_bvh_params.method == BVHBuildMethod::SBVH)
+                m_bvh_params.method = BVHBuildMethod::SAH;
+        }
+
+        const auto& bvh_report() const { return m_bvh_report; }
+
         Color get_sample(CameraRay ray);
 
+        // get_sample for a tile of camera rays traced as one packet, samples[i] for rays[i]
+        void get_sample_packet(const CameraRay* rays, int count, Color* samples);
+
+    private:
+        Color shade(const CameraRay& ray, const IntersectionResult& res) const;
+
+        void build_bvh();
+        void collapse_wide_bvh();
+
     private:
         RenderContext& m_ctx;
 
-        UnoptimizedBVHNode<Object*>* m_bvh;
-        std::vector<Object*>         m_objects;
+        BVHBuildParams m_bvh_params;
+        BVHCostReport  m_bvh_report;
+        BVHRefitState  m_bvh_refit;
+        double         m_bvh_built_cost = 0.0;
+
+        LinearBVH<SceneObject>   m_bvh;
+        WideBVH<SceneObject, 4>  m_bvh4;
+        WideBVH<SceneObject, 8>  m_bvh8;
+        std::vector<SceneObject> m_objects;
     };
 
 } // namespace Oxy::Renderer
\ No newline at end of file
@@ -0,0 +1,415 @@
+#include "renderer/tile_scheduler.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace Oxy::Renderer {
+
+    // position of the d-th cell along a hilbert curve over an n x n grid, n a power of two
+    static std::pair<int, int> hilbert_cell(int n, int d) {
+        int x = 0, y = 0;
+
+        for (int s = 1; s < n; s *= 2) {
+            int rx = 1 & (d / 2);
+            int ry = 1 & (d ^ rx);
+
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+
+                std::swap(x, y);
+            }
+
+            x += s * rx;
+            y += s * ry;
+            d /= 4;
+        }
+
+        return {x, y};
+    }
+
+    void TileScheduler::resize(int width, int height) {
+        m_tiles.clear();
+        m_order.clear();
+
+        auto tiles_x = (width + tile_size - 1) / tile_size;
+        auto tiles_y = (height + tile_size - 1) / tile_size;
+
+        for (int y = 0; y < tiles_y; y++)
+            for (int x = 0; x < tiles_x; x++) {
+                auto start_x = x * tile_size;
+                auto start_y = y * tile_size;
+
+                m_tiles.push_back(Block{start_x, start_y, std::min(width, start_x + tile_size),
+                                        std::min(height, start_y + tile_size)});
+            }
+
+        // the curve covers the next power of two, cells outside the image are skipped
+        int n = 1;
+        while (n < std::max(tiles_x, tiles_y))
+            n *= 2;
+
+        for (int d = 0; d < n * n; d++) {
+            auto [x, y] = hilbert_cell(n, d);
+
+            if (x < tiles_x && y < tiles_y)
+                m_order.push_back(y * tiles_x + x);
+        }
+
+        m_estimates.assign(m_tiles.size(), 0.0);
+        m_mean_estimate = 0.0;
+
+        for (auto& costs : m_pass_costs)
+            costs = std::vector<std::atomic<uint64_t>>(m_tiles.size());
+
+        for (auto& unfinished : m_tile_unfinished)
+            unfinished = std::vector<std::atomic<int>>(m_tiles.size());
+
+        reset();
+    }
+
+    // called by workers that found nothing to claim, one of them deals the next pass and the
+    // others try again later
+    bool TileScheduler::try_start_pass() {
+        if (has_tiles() || m_tiles.empty())
+            return false;
+
+        std::unique_lock lock(m_start_mtx, std::try_to_lock);
+
+        // someone else is dealing, or just has
+        if (!lock.owns_lock() || has_tiles())
+            return false;
+
+        auto pass = m_passes_started.load(std::memory_order_relaxed) + 1;
+
+        if (pass > m_pass_limit.load(std::memory_order_relaxed))
+            return false;
+
+        // the pass two before shares its slots and still has blocks being rendered
+        if (m_unfinished[pass % 2].load(std::memory_order_acquire) != 0)
+            return false;
+
+        start_pass(pass);
+
+        return true;
+    }
+
+    void TileScheduler::start_pass(uint32_t pass) {
+        // the slots of the pass two before, which has completed. the one right before is
+        // still being finished and is blended in by the next pass
+        auto& pass_costs      = m_pass_costs[pass % 2];
+        auto& tile_unfinished = m_tile_unfinished[pass % 2];
+        auto  total           = 0.0;
+
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            tile_unfinished[i].store(1, std::memory_order_relaxed);
+
+            auto measured = (double)pass_costs[i].exchange(0, std::memory_order_relaxed);
+
+            if (measured != 0.0)
+                m_estimates[i] = m_estimates[i] != 0.0 ? 0.5 * (m_estimates[i] + measured)
+                                                       : measured;
+
+            total += m_estimates[i];
+        }
+
+        m_mean_estimate = m_tiles.empty() ? 0.0 : total / m_tiles.size();
+
+        // tiles that were never measured count as average ones, with nothing measured yet
+        // every tile weighs the same
+        auto weight = [&](uint32_t tile) {
+            if (m_mean_estimate == 0.0)
+                return 1.0;
+
+            return m_estimates[tile] != 0.0 ? m_estimates[tile] : m_mean_estimate;
+        };
+
+        auto total_weight = 0.0;
+        for (auto tile : m_order)
+            total_weight += weight(tile);
+
+        {
+            std::lock_guard g(m_split_mtx);
+            m_split_pool.clear();
+            m_split_pool_size.store(0, std::memory_order_relaxed);
+        }
+
+        auto num_workers =
+            std::clamp(m_num_workers.load(std::memory_order_relaxed), 1, max_workers);
+
+        // counted before the deques are filled, so no claim or finish can take them below zero
+        m_unfinished[pass % 2].store((int64_t)m_order.size(), std::memory_order_release);
+        m_remaining.store((int64_t)m_order.size(), std::memory_order_release);
+        m_dealt_workers.store(num_workers, std::memory_order_relaxed);
+        m_passes_started.store(pass, std::memory_order_release);
+
+        // contiguous runs of the curve, each about an equal share of the expected cost
+        uint32_t front    = 0;
+        auto     consumed = 0.0;
+
+        for (int worker = 0; worker < max_workers; worker++) {
+            auto back = front;
+
+            if (worker == num_workers - 1) {
+                back = (uint32_t)m_order.size();
+            }
+            else if (worker < num_workers) {
+                auto share = total_weight * (worker + 1) / num_workers;
+
+                while (back < m_order.size() && consumed + 0.5 * weight(m_order[back]) < share)
+                    consumed += weight(m_order[back++]);
+            }
+
+            m_deques[worker].range.store(pack_range(front, back), std::memory_order_release);
+            front = back;
+        }
+
+        m_work_events.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    void TileScheduler::reset() {
+        for (auto& deque : m_deques)
+            deque.range.store(0, std::memory_order_release);
+
+        {
+            std::lock_guard g(m_split_mtx);
+            m_split_pool.clear();
+            m_split_pool_size.store(0, std::memory_order_relaxed);
+        }
+
+        for (auto& unfinished : m_unfinished)
+            unfinished.store(0, std::memory_order_relaxed);
+
+        for (auto& tile_unfinished : m_tile_unfinished)
+            for (auto& unfinished : tile_unfinished)
+                unfinished.store(0, std::memory_order_relaxed);
+
+        m_remaining.store(0, std::memory_order_relaxed);
+        m_passes_started.store(0, std::memory_order_relaxed);
+        m_passes_completed.store(0, std::memory_order_release);
+    }
+
+    // a block of a tile the pass before is still rendering goes to the pool, and the next one
+    // is tried. the pool only hands out blocks whose tile is done
+    std::optional<Tile> TileScheduler::take(int worker) {
+        while (true) {
+            auto tile = pop_front(worker);
+
+            if (!tile.has_value())
+                tile = pop_split();
+
+            if (!tile.has_value())
+                tile = steal(worker);
+
+            if (!tile.has_value() || !held_back(tile.value()))
+                return tile;
+
+            hold_back(tile.value());
+        }
+    }
+
+    std::optional<Tile> TileScheduler::claim(int worker) {
+        auto start = std::chrono::steady_clock::now();
+
+        auto tile = take(worker);
+
+        if (!tile.has_value() && try_start_pass())
+            tile = take(worker);
+
+        if (!tile.has_value())
+            return std::nullopt;
+
+        // with fewer blocks left than workers some are about to run dry, the expensive
+        // blocks are quartered so the pass does not end waiting on one of them. the quarters
+        // are counted before this block is taken off, so the count never passes zero early
+        if (m_remaining.load(std::memory_order_relaxed) <
+                m_dealt_workers.load(std::memory_order_relaxed) &&
+            worth_splitting(tile.value()))
+            tile = split(tile.value());
+
+        m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        m_counters.claims.fetch_add(1, std::memory_order_relaxed);
+        m_counters.claim_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+            std::memory_order_relaxed);
+
+        return tile;
+    }
+
+    void TileScheduler::finish(const Tile& tile, std::chrono::nanoseconds elapsed) {
+        m_pass_costs[tile.pass % 2][tile.tile].fetch_add(elapsed.count(),
+                                                         std::memory_order_relaxed);
+
+        auto& tile_unfinished = m_tile_unfinished[tile.pass % 2][tile.tile];
+
+        // the tile is done, the next pass may have held back a block of it
+        if (tile_unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1 &&
+            m_passes_started.load(std::memory_order_acquire) > tile.pass)
+            m_work_events.fetch_add(1, std::memory_order_acq_rel);
+
+        // the slots of the pass are free again, the one after next can be dealt
+        if (m_unfinished[tile.pass % 2].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_passes_completed.fetch_add(1, std::memory_order_release);
+            m_work_events.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+
+    TileSchedulerStats TileScheduler::stats() const {
+        return {m_counters.claims.load(std::memory_order_relaxed),
+                m_counters.steals.load(std::memory_order_relaxed),
+                m_counters.splits.load(std::memory_order_relaxed),
+                m_counters.lost_races.load(std::memory_order_relaxed),
+                m_counters.claim_ns.load(std::memory_order_relaxed)};
+    }
+
+    std::optional<Tile> TileScheduler::pop_front(int worker) {
+        if (worker < 0 || worker >= max_workers)
+            return std::nullopt;
+
+        auto& range   = m_deques[worker].range;
+        auto  current = range.load(std::memory_order_acquire);
+
+        while (true) {
+            auto front = (uint32_t)(current >> 32);
+            auto back  = (uint32_t)current;
+
+            if (front >= back)
+                return std::nullopt;
+
+            if (range.compare_exchange_weak(current, pack_range(front + 1, back),
+                                            std::memory_order_acq_rel))
+                return make_tile(front);
+
+            m_counters.lost_races.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // takes the last tile of the fullest deque, the owner keeps the start of its run
+    std::optional<Tile> TileScheduler::steal(int worker) {
+        auto num_deques = m_dealt_workers.load(std::memory_order_relaxed);
+
+        while (true) {
+            int      victim    = -1;
+            uint64_t range     = 0;
+            uint32_t most_left = 0;
+
+            for (int i = 0; i < num_deques; i++) {
+                if (i == worker)
+                    continue;
+
+                auto current = m_deques[i].range.load(std::memory_order_acquire);
+                auto left    = (uint32_t)current - (uint32_t)(current >> 32);
+
+                if ((uint32_t)(current >> 32) < (uint32_t)current && left > most_left) {
+                    victim    = i;
+                    range     = current;
+                    most_left = left;
+                }
+            }
+
+            if (victim == -1)
+                return std::nullopt;
+
+            auto front = (uint32_t)(range >> 32);
+            auto back  = (uint32_t)range;
+
+            if (m_deques[victim].range.compare_exchange_strong(
+                    range, pack_range(front, back - 1), std::memory_order_acq_rel)) {
+                m_counters.steals.fetch_add(1, std::memory_order_relaxed);
+                return make_tile(back - 1);
+            }
+
+            m_counters.lost_races.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::optional<Tile> TileScheduler::pop_split() {
+        if (m_split_pool_size.load(std::memory_order_acquire) == 0)
+            return std::nullopt;
+
+        std::lock_guard g(m_split_mtx);
+
+        auto found = std::find_if(m_split_pool.rbegin(), m_split_pool.rend(),
+                                  [this](const Tile& tile) { return !held_back(tile); });
+
+        if (found == m_split_pool.rend())
+            return std::nullopt;
+
+        auto tile = *found;
+        m_split_pool.erase(std::next(found).base());
+        m_split_pool_size.store(m_split_pool.size(), std::memory_order_release);
+
+        return tile;
+    }
+
+    void TileScheduler::hold_back(const Tile& tile) {
+        std::lock_guard g(m_split_mtx);
+        m_split_pool.push_back(tile);
+        m_split_pool_size.store(m_split_pool.size(), std::memory_order_release);
+    }
+
+    // the pass before still has blocks of the tile to finish, both would splat the same pixels
+    bool TileScheduler::held_back(const Tile& tile) const {
+        if (tile.pass <= 1)
+            return false;
+
+        auto& unfinished = m_tile_unfinished[(tile.pass - 1) % 2][tile.tile];
+        return unfinished.load(std::memory_order_acquire) != 0;
+    }
+
+    // blocks expected to cost less than an average tile are not worth the extra claims
+    bool TileScheduler::worth_splitting(const Tile& tile) const {
+        const auto& block = tile.block;
+
+        if (block.end_x - block.start_x < 2 * min_split_size ||
+            block.end_y - block.start_y < 2 * min_split_size)
+            return false;
+
+        if (m_mean_estimate == 0.0)
+            return true;
+
+        return m_estimates[tile.tile] / (1 << 2 * tile.level) >= m_mean_estimate;
+    }
+
+    // keeps the first quarter, the other three go to the pool
+    Tile TileScheduler::split(const Tile& tile) {
+        const auto& block = tile.block;
+
+        auto mid_x = (block.start_x + block.end_x) / 2;
+        auto mid_y = (block.start_y + block.end_y) / 2;
+        auto level = tile.level + 1;
+
+        Tile quarters[4] = {
+            {{block.start_x, block.start_y, mid_x, mid_y}, tile.tile, tile.pass, level},
+            {{mid_x, block.start_y, block.end_x, mid_y}, tile.tile, tile.pass, level},
+            {{block.start_x, mid_y, mid_x, block.end_y}, tile.tile, tile.pass, level},
+            {{mid_x, mid_y, block.end_x, block.end_y}, tile.tile, tile.pass, level},
+        };
+
+        m_unfinished[tile.pass % 2].fetch_add(3, std::memory_order_acq_rel);
+        m_tile_unfinished[tile.pass % 2][tile.tile].fetch_add(3, std::memory_order_acq_rel);
+        m_remaining.fetch_add(3, std::memory_order_acq_rel);
+
+        {
+            std::lock_guard g(m_split_mtx);
+            m_split_pool.insert(m_split_pool.end(), quarters + 1, quarters + 4);
+            m_split_pool_size.store(m_split_pool.size(), std::memory_order_release);
+        }
+
+        m_counters.splits.fetch_add(1, std::memory_order_relaxed);
+        m_work_events.fetch_add(1, std::memory_order_acq_rel);
+
+        return quarters[0];
+    }
+
+    Tile TileScheduler::make_tile(uint32_t order_index) const {
+        auto tile = m_order[order_index];
+        return {m_tiles[tile], tile, m_passes_started.load(std::memory_order_acquire), 0};
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace Oxy::Renderer {
+
+    struct Block {
+        int start_x, start_y;
+        int end_x, end_y;
+    };
+
+    // a block handed to a worker, tile is the full size tile it was cut from
+    struct Tile {
+        Block    block;
+        uint32_t tile;
+        uint32_t pass;
+        int      level; // times the block was split, it covers 4^-level of its tile
+    };
+
+    struct TileSchedulerStats {
+        uint64_t claims     = 0;
+        uint64_t steals     = 0; // claims taken from the back of another worker's deque
+        uint64_t splits     = 0; // blocks quartered towards the end of a pass
+        uint64_t lost_races = 0; // deque updates retried because another worker got there first
+        uint64_t claim_ns   = 0; // total time spent inside claim()
+    };
+
+    // hands out the same tiles once per pass. the tiles are laid out along a hilbert curve
+    // and dealt to the workers in contiguous runs of about equal cost, measured in earlier
+    // passes, so every worker renders a coherent patch of the image. a worker that runs out
+    // steals from the back of the fullest deque, and towards the end of a pass the expensive
+    // blocks are split into quarters that go to a shared pool.
+    //
+    // the workers start the passes themselves, whoever finds the current one fully claimed
+    // deals the next while the last blocks of the old one are still being rendered. the film
+    // counts samples per pixel, so the passes can overlap, but not on the same tile: a block
+    // is held back until the pass before has finished its tile, the film is not safe for two
+    // writers. a pass only reuses the slots of the one two before it, so at most two are in
+    // flight
+    class TileScheduler final {
+    public:
+        static constexpr int tile_size   = 32;
+        static constexpr int max_workers = 256;
+
+        // blocks smaller than this are never split
+        static constexpr int min_split_size = 8;
+
+        // only while no worker is claiming or still has a block to finish. a new resolution
+        // forgets the measured costs
+        void resize(int width, int height);
+
+        // workers the next passes are dealt to, workers with a higher id only steal
+        void set_num_workers(int num_workers) {
+            m_num_workers.store(num_workers, std::memory_order_relaxed);
+        }
+
+        // no pass is started beyond this many
+        void set_pass_limit(uint32_t passes) {
+            m_pass_limit.store(passes, std::memory_order_relaxed);
+        }
+
+        // forgets the passes and drops the blocks nobody has claimed yet, only while no
+        // worker is claiming
+        void reset();
+
+        // starts the next pass if the current one is fully claimed and the limit allows it
+        std::optional<Tile> claim(int worker);
+
+        // every claimed block has to be reported back, the pass completes with its last block
+        // and the next passes are dealt by how long the blocks took
+        void finish(const Tile& tile, std::chrono::nanoseconds elapsed);
+
+        // blocks of the current pass nobody has claimed yet
+        bool has_tiles() const { return m_remaining.load(std::memory_order_acquire) > 0; }
+
+        // changes whenever blocks may have become claimable: a pass was dealt or completed, or
+        // a block was split. a worker that found nothing only has to look again after it moved
+        uint64_t work_events() const { return m_work_events.load(std::memory_order_acquire); }
+
+        uint32_t passes_started() const { return m_passes_started.load(std::memory_order_acquire); }
+
+        // passes whose every block has been rendered
+        uint32_t passes_completed() const {
+            return m_passes_completed.load(std::memory_order_acquire);
+        }
+
+        const auto& tiles() const { return m_tiles; }
+
+        TileSchedulerStats stats() const;
+
+    private:
+        // front and back of a run of m_order packed into one word, so the owner popping the
+        // front and thieves popping the back agree through a single compare and swap
+        struct alignas(64) WorkerDeque {
+            std::atomic<uint64_t> range = 0;
+        };
+
+        static uint64_t pack_range(uint32_t front, uint32_t back) {
+            return (uint64_t)front << 32 | back;
+        }
+
+        bool try_start_pass();
+        void start_pass(uint32_t pass);
+
+        std::optional<Tile> take(int worker);
+        std::optional<Tile> pop_front(int worker);
+        std::optional<Tile> steal(int worker);
+        std::optional<Tile> pop_split();
+        void                hold_back(const Tile& tile);
+
+        bool held_back(const Tile& tile) const;
+
+        Tile split(const Tile& tile);
+        bool worth_splitting(const Tile& tile) const;
+
+        Tile make_tile(uint32_t order_index) const;
+
+    private:
+        std::vector<Block>    m_tiles; // row major, the full size tiles
+        std::vector<uint32_t> m_order; // tile indices along the hilbert curve
+
+        // nanoseconds per tile, blended over the passes. written by start_pass only
+        std::vector<double> m_estimates;
+        double              m_mean_estimate = 0.0;
+
+        // nanoseconds per tile measured in the last two passes, by pass parity
+        std::array<std::vector<std::atomic<uint64_t>>, 2> m_pass_costs;
+
+        std::array<WorkerDeque, max_workers> m_deques;
+        std::atomic<int>                     m_num_workers = 1;
+
+        alignas(64) std::atomic<int64_t> m_remaining     = 0; // blocks not claimed yet
+        std::atomic<int>                 m_dealt_workers = 1; // deques the pass was dealt to
+
+        // blocks claimed or not that are yet to be finished, by pass parity, in total and per
+        // tile
+        std::array<std::atomic<int64_t>, 2>          m_unfinished = {};
+        std::array<std::vector<std::atomic<int>>, 2> m_tile_unfinished;
+
+        std::atomic<uint32_t> m_passes_started   = 0;
+        std::atomic<uint32_t> m_passes_completed = 0;
+        std::atomic<uint32_t> m_pass_limit       = 0;
+        std::atomic<uint64_t> m_work_events      = 0;
+
+        std::mutex m_start_mtx; // one worker deals the next pass, the others keep going
+
+        // quarters of split blocks and blocks held back, only used at the end of a pass
+        std::mutex          m_split_mtx;
+        std::vector<Tile>   m_split_pool;
+        std::atomic<size_t> m_split_pool_size = 0;
+
+        struct alignas(64) Counters {
+            std::atomic<uint64_t> claims     = 0;
+            std::atomic<uint64_t> steals     = 0;
+            std::atomic<uint64_t> splits     = 0;
+            std::atomic<uint64_t> lost_races = 0;
+            std::atomic<uint64_t> claim_ns   = 0;
+        } m_counters;
+    };
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,79 @@
+#include "renderer/utils/binary_cache.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <thread>
+
+#include <unistd.h>
+
+namespace Oxy::Renderer {
+
+    static constexpr char     binary_cache_magic[8] = {'O', 'X', 'Y', 'C', 'A', 'C', 'H', 'E'};
+    static constexpr uint32_t binary_cache_endian   = 0x01020304;
+
+    CacheWriter::CacheWriter(const std::string& path, uint64_t key)
+        : m_path(path) {
+
+        // several meshes loading the same file may write the same cache at once
+        m_tmp_path = path + "." + std::to_string(getpid()) + "." +
+                     std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) +
+                     ".tmp";
+
+        m_out.open(m_tmp_path, std::ios::binary | std::ios::trunc);
+
+        BinaryCacheHeader header{};
+        std::memcpy(header.magic, binary_cache_magic, sizeof(header.magic));
+        header.format_version = binary_cache_format_version;
+        header.endian_check   = binary_cache_endian;
+        header.key            = key;
+
+        m_out.write((const char*)&header, sizeof(header));
+        pad();
+    }
+
+    bool CacheWriter::finish() {
+        m_out.close();
+
+        if (m_out.fail() || std::rename(m_tmp_path.c_str(), m_path.c_str()) != 0) {
+            std::remove(m_tmp_path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    void CacheWriter::pad() {
+        static const char zeros[binary_cache_alignment] = {};
+
+        auto offset = (size_t)m_out.tellp();
+        auto rem    = offset % binary_cache_alignment;
+
+        if (rem != 0)
+            m_out.write(zeros, binary_cache_alignment - rem);
+    }
+
+    bool CacheReader::open(const std::string& path, uint64_t key) {
+        m_offset = 0;
+
+        if (!m_file.open(path))
+            return false;
+
+        BinaryCacheHeader header;
+
+        if (m_file.size() < sizeof(header))
+            return false;
+
+        std::memcpy(&header, m_file.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, binary_cache_magic, sizeof(header.magic)) != 0 ||
+            header.format_version != binary_cache_format_version ||
+            header.endian_check != binary_cache_endian || header.key != key)
+            return false;
+
+        m_offset = (sizeof(header) + binary_cache_alignment - 1) / binary_cache_alignment *
+                   binary_cache_alignment;
+
+        return true;
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "renderer/utils/mapped_file.hpp"
+
+namespace Oxy::Renderer {
+
+    // fnv style hash over 8 byte words, fast enough to key caches on the contents of big files.
+    // not meant to resist anything but accidental collisions
+    inline uint64_t hash_bytes(const void* data, size_t size,
+                               uint64_t seed = 0xcbf29ce484222325ull) {
+        constexpr uint64_t prime = 0x100000001b3ull;
+
+        auto bytes = (const unsigned char*)data;
+        auto hash  = (seed ^ size) * prime;
+
+        size_t i = 0;
+
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i, 8);
+
+            hash = (hash ^ word) * prime;
+            hash ^= hash >> 29;
+        }
+
+        for (; i < size; i++)
+            hash = (hash ^ bytes[i]) * prime;
+
+        return hash;
+    }
+
+    template <typename T>
+    uint64_t hash_value(const T& value, uint64_t seed) {
+        static_assert(std::has_unique_object_representations_v<T> || std::is_floating_point_v<T>);
+        return hash_bytes(&value, sizeof(T), seed);
+    }
+
+    // cache files are a header followed by arrays of trivially copyable values, every array is
+    // prefixed by its element count and size and starts 64 byte aligned. native endianness,
+    // a file written on another machine simply fails the header check
+    struct BinaryCacheHeader {
+        char     magic[8];
+        uint32_t format_version;
+        uint32_t endian_check;
+        uint64_t key;
+    };
+
+    constexpr uint32_t binary_cache_format_version = 1;
+    constexpr size_t   binary_cache_alignment      = 64;
+
+    class CacheWriter final {
+    public:
+        // writes to a temporary file, finish() renames it into place so readers never see a
+        // partially written cache
+        CacheWriter(const std::string& path, uint64_t key);
+
+        template <typename T>
+        void write(const T* values, size_t count) {
+            static_assert(std::is_trivially_copyable_v<T>);
+
+            uint64_t record[2] = {count, sizeof(T)};
+
+            m_out.write((const char*)record, sizeof(record));
+            pad();
+            m_out.write((const char*)values, count * sizeof(T));
+            pad();
+        }
+
+        template <typename T>
+        void write(const std::vector<T>& values) {
+            write(values.data(), values.size());
+        }
+
+        template <typename T>
+        void write_value(const T& value) {
+            write(&value, 1);
+        }
+
+        bool finish();
+
+    private:
+        void pad();
+
+    private:
+        std::string   m_path;
+        std::string   m_tmp_path;
+        std::ofstream m_out;
+    };
+
+    class CacheReader final {
+    public:
+        // false if the file is missing, from another format version or for another key
+        bool open(const std::string& path, uint64_t key);
+
+        // copies the next array out of the mapping, false if the file ends early or the
+        // element size does not match
+        template <typename T>
+        bool read(std::vector<T>& values) {
+            size_t count;
+            auto   data = next<T>(count);
+
+            if (data == nullptr)
+                return false;
+
+            values.assign(data, data + count);
+
+            return true;
+        }
+
+        template <typename T>
+        bool read_value(T& value) {
+            size_t count;
+            auto   data = next<T>(count);
+
+            if (data == nullptr || count != 1)
+                return false;
+
+            std::memcpy((void*)&value, data, sizeof(T));
+
+            return true;
+        }
+
+    private:
+        template <typename T>
+        const T* next(size_t& count) {
+            static_assert(std::is_trivially_copyable_v<T>);
+
+            uint64_t record[2];
+
+            if (m_offset + sizeof(record) > m_file.size())
+                return nullptr;
+
+            std::memcpy(record, m_file.data() + m_offset, sizeof(record));
+
+            auto data = align(m_offset + sizeof(record));
+            auto end  = data + record[0] * record[1];
+
+            if (record[1] != sizeof(T) || end > m_file.size() || end < data)
+                return nullptr;
+
+            m_offset = align(end);
+            count    = record[0];
+
+            return (const T*)(m_file.data() + data);
+        }
+
+        static size_t align(size_t offset) {
+            return (offset + binary_cache_alignment - 1) / binary_cache_alignment *
+                   binary_cache_alignment;
+        }
+
+    private:
+        MappedFile m_file;
+        size_t     m_offset = 0;
+    };
+
+} // namespace Oxy::Renderer
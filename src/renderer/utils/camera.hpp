@@ -1,25 +1,29 @@
 #pragma once
 
-#include <random>
+#include <cmath>
 
 #include <glm/glm.hpp>
 
+#include "renderer/utils/real.hpp"
+
 namespace Oxy::Renderer {
 
-    struct CameraRay {
-        CameraRay(const glm::dvec3& orig, const glm::dvec3& direction)
+    template <typename R>
+    struct CameraRayT {
+        CameraRayT() = default;
+
+        CameraRayT(const Vec3<R>& orig, const Vec3<R>& direction)
             : origin(orig)
             , dir(direction) {}
 
-        glm::dvec3 origin;
-        glm::dvec3 dir;
+        Vec3<R> origin;
+        Vec3<R> dir;
     };
 
+    using CameraRay = CameraRayT<Real>;
+
     class Camera {
     public:
-        Camera()
-            : m_dist(0.0, 1.0) {}
-
         void set_fov(double fov_in_degrees) {
             m_fov = 1.0 / std::tan(3.1416 / 180.0 * fov_in_degrees * 0.5);
         }
@@ -41,18 +45,19 @@ namespace Oxy::Renderer {
             set_dir(dir);
         }
 
-        CameraRay get_ray(int x, int y, int width, int height) {
+        // the camera itself stays double, only the ray it hands out is converted. jitter is
+        // the position inside the pixel, drawn by the caller's sampler
+        template <typename R = Real>
+        CameraRayT<R> get_ray(int x, int y, int width, int height,
+                              glm::dvec2 jitter = glm::dvec2(0.5)) const {
             auto aspect = (double)height / (double)width;
 
-            auto tent_x = m_dist(m_re);
-            auto tent_y = m_dist(m_re);
-
-            auto xf = 2.0 * (((double)x + tent_x) / (double)width - 0.5);
-            auto yf = 2.0 * aspect * (((double)y + tent_y) / (double)height - 0.5);
+            auto xf = 2.0 * (((double)x + jitter.x) / (double)width - 0.5);
+            auto yf = 2.0 * aspect * (((double)y + jitter.y) / (double)height - 0.5);
 
             auto dir = glm::normalize(m_forward * m_fov + m_left * xf - m_up * yf);
 
-            return CameraRay(m_origin, dir);
+            return CameraRayT<R>(m_origin, dir);
         }
 
     private:
@@ -63,9 +68,6 @@ namespace Oxy::Renderer {
         glm::dvec3 m_up;
 
         double m_fov;
-
-        std::uniform_real_distribution<double> m_dist;
-        std::default_random_engine             m_re;
     };
 
 } // namespace Oxy::Renderer
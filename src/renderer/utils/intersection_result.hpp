@@ -1,19 +1,26 @@
 #pragma once
 
+#include <limits>
+
 #include <glm/glm.hpp>
 
+#include "renderer/utils/real.hpp"
+
 namespace Oxy::Renderer {
 
     class Object; // forwarddecl
 
-    struct IntersectionResult {
-        bool   hit = false;
-        double t   = std::numeric_limits<double>::max();
+    template <typename R>
+    struct IntersectionResultT {
+        bool hit = false;
+        R    t   = std::numeric_limits<R>::max();
 
-        glm::dvec3 hitpos{};
-        glm::dvec3 hitnormal{};
+        Vec3<R> hitpos{};
+        Vec3<R> hitnormal{};
 
         Object* hitobj = nullptr;
     };
 
+    using IntersectionResult = IntersectionResultT<Real>;
+
 } // namespace Oxy::Renderer
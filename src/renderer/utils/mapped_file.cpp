@@ -0,0 +1,59 @@
+#include "renderer/utils/mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Oxy::Renderer {
+
+    bool MappedFile::open(const std::string& path) {
+        close();
+
+        auto fd = ::open(path.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+
+        if (fstat(fd, &st) != 0) {
+            ::close(fd);
+            return false;
+        }
+
+        m_size = (size_t)st.st_size;
+
+        // mmap refuses empty mappings, an empty file is still a valid open file
+        if (m_size != 0) {
+            m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (m_data == MAP_FAILED) {
+                m_data = nullptr;
+                m_size = 0;
+
+                ::close(fd);
+                return false;
+            }
+
+            madvise(m_data, m_size, MADV_SEQUENTIAL);
+        }
+
+        // the mapping keeps the file alive on its own
+        ::close(fd);
+
+        m_open = true;
+
+        return true;
+    }
+
+    void MappedFile::close() {
+        if (m_data != nullptr)
+            munmap(m_data, m_size);
+
+        m_data = nullptr;
+        m_size = 0;
+        m_open = false;
+    }
+
+} // namespace Oxy::Renderer
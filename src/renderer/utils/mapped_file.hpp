@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace Oxy::Renderer {
+
+    // read only memory mapping of a whole file, unmapped on destruction
+    class MappedFile final {
+    public:
+        MappedFile() = default;
+        ~MappedFile() { close(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& path);
+        void close();
+
+        bool is_open() const { return m_open; }
+
+        const char* data() const { return (const char*)m_data; }
+        size_t      size() const { return m_size; }
+
+    private:
+        void*  m_data = nullptr;
+        size_t m_size = 0;
+        bool   m_open = false;
+    };
+
+} // namespace Oxy::Renderer
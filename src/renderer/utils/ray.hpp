@@ -0,0 +1,42 @@
+#pragma once
+
+#include <limits>
+
+#include <glm/glm.hpp>
+
+#include "renderer/utils/real.hpp"
+
+namespace Oxy::Renderer {
+
+    template <typename R>
+    struct RayT {
+        RayT() = default; // left uninitialized, for ray packet arrays
+
+        RayT(const Vec3<R>& orig, const Vec3<R>& direction, R t_min = 0,
+             R t_max = std::numeric_limits<R>::max())
+            : origin(orig)
+            , dir(direction)
+            , inv_dir(R(1) / direction.x, R(1) / direction.y, R(1) / direction.z)
+            , tmin(t_min)
+            , tmax(t_max) {
+
+            for (int axis = 0; axis < 3; axis++)
+                sign[axis] = inv_dir[axis] < R(0) ? 1 : 0;
+        }
+
+        Vec3<R> at(R t) const { return origin + dir * t; }
+
+        Vec3<R> origin;
+        Vec3<R> dir;
+        Vec3<R> inv_dir;
+
+        int sign[3]; // 1 where the direction is negative
+
+        // valid hit interval, traversal shrinks tmax every time a closer hit is found
+        R tmin;
+        R tmax;
+    };
+
+    using Ray = RayT<Real>;
+
+} // namespace Oxy::Renderer
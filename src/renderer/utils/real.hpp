@@ -0,0 +1,35 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+namespace Oxy::Renderer {
+
+    // precision of rays, hits and primitive tests. the bvh nodes and triangle blocks are float
+    // either way, building with OXY_SINGLE_PRECISION (premake5 --single-precision) keeps the
+    // whole traversal in float as well. builds and object transforms always stay double
+#ifdef OXY_SINGLE_PRECISION
+    using Real = float;
+#else
+    using Real = double;
+#endif
+
+    template <typename R>
+    using Vec3 = glm::vec<3, R, glm::defaultp>;
+
+    // relative rounding error bound of n floating point operations, pbrt's gamma(n)
+    template <typename R>
+    constexpr R rounding_gamma(int n) {
+        constexpr R half_eps = std::numeric_limits<R>::epsilon() * R(0.5);
+        return (n * half_eps) / (1 - n * half_eps);
+    }
+
+    // a ray distance as float, clamped so the double max stays representable
+    template <typename R>
+    inline float clamp_to_float(R value) {
+        return (float)std::min<R>(value, (R)std::numeric_limits<float>::max());
+    }
+
+} // namespace Oxy::Renderer
@@ -0,0 +1,124 @@
+#include "renderer/utils/sampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace Oxy::Renderer {
+
+    // ulichney's void and cluster. the energy of a cell is a gaussian over its distance to
+    // every set cell, wrapping around the edges so the mask tiles. the set cells are ranked by
+    // removing the tightest cluster first, the rest by filling the largest void
+    static std::vector<float> make_blue_noise_mask() {
+        constexpr int    n     = blue_noise_size;
+        constexpr int    size  = n * n;
+        constexpr double sigma = 1.5;
+
+        std::vector<double> kernel(size);
+
+        for (int dy = 0; dy < n; dy++)
+            for (int dx = 0; dx < n; dx++) {
+                auto x = (double)std::min(dx, n - dx);
+                auto y = (double)std::min(dy, n - dy);
+
+                kernel[dy * n + dx] = std::exp(-(x * x + y * y) / (2.0 * sigma * sigma));
+            }
+
+        std::vector<bool>   pattern(size, false);
+        std::vector<double> energy(size, 0.0);
+
+        auto toggle = [&](int i) {
+            auto sign = pattern[i] ? -1.0 : 1.0;
+            auto px   = i % n;
+            auto py   = i / n;
+
+            pattern[i] = !pattern[i];
+
+            for (int y = 0; y < n; y++) {
+                auto row = ((y - py + n) % n) * n;
+
+                for (int x = 0; x < n; x++)
+                    energy[y * n + x] += sign * kernel[row + (x - px + n) % n];
+            }
+        };
+
+        auto tightest_cluster = [&] {
+            int best = -1;
+
+            for (int i = 0; i < size; i++)
+                if (pattern[i] && (best == -1 || energy[i] > energy[best]))
+                    best = i;
+
+            return best;
+        };
+
+        auto largest_void = [&] {
+            int best = -1;
+
+            for (int i = 0; i < size; i++)
+                if (!pattern[i] && (best == -1 || energy[i] < energy[best]))
+                    best = i;
+
+            return best;
+        };
+
+        // a tenth of the cells at random, fixed seed so every run gets the same mask
+        constexpr int initial = size / 10;
+
+        Pcg32 rng(0x5eed);
+
+        for (int set = 0; set < initial;) {
+            auto i = (int)(rng.next() % size);
+
+            if (!pattern[i]) {
+                toggle(i);
+                set++;
+            }
+        }
+
+        // move the tightest cluster into the largest void until it already is the largest void
+        while (true) {
+            auto cluster = tightest_cluster();
+            toggle(cluster);
+
+            auto hole = largest_void();
+            toggle(hole);
+
+            if (hole == cluster)
+                break;
+        }
+
+        std::vector<int> rank(size);
+
+        auto prototype        = pattern;
+        auto prototype_energy = energy;
+
+        for (int r = initial - 1; r >= 0; r--) {
+            auto cluster = tightest_cluster();
+            rank[cluster] = r;
+            toggle(cluster);
+        }
+
+        pattern = prototype;
+        energy  = prototype_energy;
+
+        for (int r = initial; r < size; r++) {
+            auto hole  = largest_void();
+            rank[hole] = r;
+            toggle(hole);
+        }
+
+        std::vector<float> mask(size);
+
+        for (int i = 0; i < size; i++)
+            mask[i] = ((float)rank[i] + 0.5f) / (float)size;
+
+        return mask;
+    }
+
+    const float* blue_noise_mask() {
+        static const auto mask = make_blue_noise_mask();
+        return mask.data();
+    }
+
+} // namespace Oxy::Renderer
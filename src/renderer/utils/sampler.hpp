@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace Oxy::Renderer {
+
+    enum class SamplerType {
+        Independent, // uncorrelated random numbers
+        Sobol,       // owen scrambled sobol points, decorrelated per pixel
+        BlueNoise,   // one scrambled sobol sequence rotated per pixel by a blue noise mask
+    };
+
+    // splitmix64's finalizer, every input bit flips about half of the output bits
+    inline uint64_t mix_bits(uint64_t v) {
+        v ^= v >> 31;
+        v *= 0x7fb5d329728ea185;
+        v ^= v >> 27;
+        v *= 0x81dadef4bc2dd44d;
+        v ^= v >> 33;
+        return v;
+    }
+
+    inline uint64_t hash_combine(uint64_t seed, uint64_t v) {
+        return mix_bits(seed ^ (v + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2)));
+    }
+
+    // pcg32 xsh rr, small enough to live on the stack of a single pixel sample
+    class Pcg32 final {
+    public:
+        Pcg32(uint64_t seed, uint64_t stream = 0)
+            : m_inc(stream << 1 | 1) {
+            next();
+            m_state += seed;
+            next();
+        }
+
+        uint32_t next() {
+            auto old = m_state;
+            m_state  = old * 6364136223846793005ull + m_inc;
+
+            auto xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+            auto rot        = (uint32_t)(old >> 59);
+
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+
+    private:
+        uint64_t m_state = 0;
+        uint64_t m_inc;
+    };
+
+    inline uint32_t reverse_bits(uint32_t v) {
+        v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+        v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+        v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+        v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    // the first two sobol dimensions as 32 bit fractions, neither needs a direction table
+    inline uint32_t sobol_dim0(uint32_t index) { return reverse_bits(index); }
+
+    inline uint32_t sobol_dim1(uint32_t index) {
+        uint32_t result = 0;
+
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+            if (index & 1)
+                result ^= v;
+
+        return result;
+    }
+
+    // hash based owen scrambling, burley 2020 with vegdahl's constants. scrambles the bits
+    // from the top down, so points that share a power of two stratum keep sharing one
+    inline uint32_t owen_scramble(uint32_t v, uint32_t seed) {
+        v = reverse_bits(v);
+
+        v ^= v * 0x3d20adea;
+        v += seed;
+        v *= (seed >> 16) | 1;
+        v ^= v * 0x05526c56;
+        v ^= v * 0x53a22864;
+
+        return reverse_bits(v);
+    }
+
+    inline double to_unit(uint32_t v) { return (double)v * (1.0 / 4294967296.0); }
+
+    // rank of every cell of a tileable blue noise mask, void and cluster over a torus. built
+    // on first use
+    constexpr int blue_noise_size = 64;
+    const float*  blue_noise_mask();
+
+    inline double blue_noise(int x, int y) {
+        constexpr int wrap = blue_noise_size - 1;
+        return blue_noise_mask()[(y & wrap) * blue_noise_size + (x & wrap)];
+    }
+
+    // the dimensions of one sample of one pixel, drawn in order. every value only depends on
+    // the seed, the pixel, the sample index and the dimension, never on which thread draws it
+    // or what it drew before, so a render comes out the same with any number of workers
+    class PixelSampler final {
+    public:
+        PixelSampler(SamplerType type, uint64_t seed, int x, int y, uint32_t sample)
+            : m_type(type)
+            , m_seed(seed)
+            , m_pixel_seed(hash_combine(hash_combine(seed, (uint32_t)x), (uint32_t)y))
+            , m_x(x)
+            , m_y(y)
+            , m_sample(sample)
+            , m_rng(hash_combine(m_pixel_seed, sample)) {}
+
+        double get_1d() {
+            auto dim = m_dimension++;
+
+            switch (m_type) {
+            case SamplerType::Independent: return to_unit(m_rng.next());
+
+            case SamplerType::Sobol: {
+                auto seed = (uint32_t)hash_combine(m_pixel_seed, dim);
+                return to_unit(owen_scramble(sobol_dim0(shuffled_index(seed)), seed));
+            }
+
+            case SamplerType::BlueNoise: {
+                auto seed = (uint32_t)hash_combine(m_seed, dim);
+                auto u    = to_unit(owen_scramble(sobol_dim0(m_sample), seed));
+
+                return rotate(u, mask_offset(seed));
+            }
+            }
+
+            return 0.5;
+        }
+
+        glm::dvec2 get_2d() {
+            auto dim = m_dimension++;
+
+            switch (m_type) {
+            case SamplerType::Independent: {
+                auto u = to_unit(m_rng.next());
+                return {u, to_unit(m_rng.next())};
+            }
+
+            // one 2d sobol pattern per dimension pair, each with its own scramble and order
+            case SamplerType::Sobol: {
+                auto seed  = hash_combine(m_pixel_seed, dim);
+                auto index = shuffled_index((uint32_t)seed);
+
+                return {to_unit(owen_scramble(sobol_dim0(index), (uint32_t)(seed >> 32))),
+                        to_unit(owen_scramble(sobol_dim1(index), (uint32_t)mix_bits(seed)))};
+            }
+
+            // the same points in every pixel, only the rotation varies across the screen, so
+            // the error of neighbouring pixels is anti correlated and looks like fine grain
+            case SamplerType::BlueNoise: {
+                auto seed = hash_combine(m_seed, dim);
+
+                auto u = to_unit(owen_scramble(sobol_dim0(m_sample), (uint32_t)(seed >> 32)));
+                auto v = to_unit(owen_scramble(sobol_dim1(m_sample), (uint32_t)mix_bits(seed)));
+
+                return {rotate(u, mask_offset((uint32_t)seed)),
+                        rotate(v, mask_offset((uint32_t)(seed >> 16)))};
+            }
+            }
+
+            return {0.5, 0.5};
+        }
+
+    private:
+        // a scramble of the index keeps every power of two prefix a power of two stratum
+        uint32_t shuffled_index(uint32_t seed) const {
+            return owen_scramble(m_sample, (uint32_t)mix_bits(seed));
+        }
+
+        // every dimension reads the mask at its own toroidal offset
+        double mask_offset(uint32_t seed) const {
+            return blue_noise(m_x + (int)(seed % blue_noise_size),
+                              m_y + (int)(seed / blue_noise_size % blue_noise_size));
+        }
+
+        static double rotate(double u, double offset) {
+            u += offset;
+            return u >= 1.0 ? u - 1.0 : u;
+        }
+
+    private:
+        SamplerType m_type;
+        uint64_t    m_seed;
+        uint64_t    m_pixel_seed;
+        int         m_x, m_y;
+        uint32_t    m_sample;
+        uint32_t    m_dimension = 0;
+        Pcg32       m_rng;
+    };
+
+    // hands out the pixel samplers, one per sample of a pixel. the renderer uses the pass as
+    // the sample index
+    class Sampler final {
+    public:
+        Sampler(SamplerType type = SamplerType::Sobol, uint64_t seed = 0)
+            : m_type(type)
+            , m_seed(seed) {}
+
+        auto type() const { return m_type; }
+        auto seed() const { return m_seed; }
+
+        PixelSampler pixel(int x, int y, uint32_t sample) const {
+            return PixelSampler(m_type, m_seed, x, y, sample);
+        }
+
+    private:
+        SamplerType m_type;
+        uint64_t    m_seed;
+    };
+
+} // namespace Oxy::Renderer
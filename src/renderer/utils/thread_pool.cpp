@@ -0,0 +1,77 @@
+#include "renderer/utils/thread_pool.hpp"
+
+namespace Oxy::Renderer {
+
+    ThreadPool::ThreadPool(unsigned int num_workers) {
+        for (unsigned int i = 0; i < num_workers; i++)
+            m_workers.push_back(std::thread(&ThreadPool::worker_func, this));
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard lk(m_queue_mtx);
+            m_stopping = true;
+        }
+
+        m_queue_cv.notify_all();
+
+        for (auto& thread : m_workers)
+            if (thread.joinable())
+                thread.join();
+    }
+
+    void ThreadPool::submit(std::function<void()> task) {
+        {
+            std::lock_guard lk(m_queue_mtx);
+            m_queue.push_back(std::move(task));
+        }
+
+        m_queue_cv.notify_one();
+        m_waiters_cv.notify_all();
+    }
+
+    bool ThreadPool::run_one() {
+        std::function<void()> task;
+
+        {
+            std::lock_guard lk(m_queue_mtx);
+
+            if (m_queue.empty())
+                return false;
+
+            // newest first, so a waiting thread picks up the smallest and most local work
+            task = std::move(m_queue.back());
+            m_queue.pop_back();
+        }
+
+        task();
+
+        return true;
+    }
+
+    ThreadPool& ThreadPool::global() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    void ThreadPool::worker_func() {
+        while (true) {
+            std::function<void()> task;
+
+            {
+                std::unique_lock lk(m_queue_mtx);
+                m_queue_cv.wait(lk, [this] { return m_stopping || !m_queue.empty(); });
+
+                if (m_stopping && m_queue.empty())
+                    return;
+
+                // oldest first, the oldest tasks are the biggest subtrees
+                task = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+
+            task();
+        }
+    }
+
+} // namespace Oxy::Renderer
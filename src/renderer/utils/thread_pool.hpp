@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Oxy::Renderer {
+
+    class ThreadPool final {
+    public:
+        ThreadPool(unsigned int num_workers = default_num_workers());
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        void submit(std::function<void()> task);
+
+        // runs one queued task on the calling thread, returns false if the queue was empty
+        bool run_one();
+
+        // blocks until a task is queued or done() holds. done is checked under the queue lock,
+        // so whatever it reads has to change under that lock as well, see notify_waiters_if
+        template <typename Pred>
+        void wait_for_task(Pred&& done) {
+            std::unique_lock lk(m_queue_mtx);
+            m_waiters_cv.wait(lk, [&] { return !m_queue.empty() || done(); });
+        }
+
+        // runs fn under the queue lock, the threads in wait_for_task wake if it returns true
+        template <typename Fn>
+        void notify_waiters_if(Fn&& fn) {
+            std::lock_guard lk(m_queue_mtx);
+
+            if (fn())
+                m_waiters_cv.notify_all();
+        }
+
+        auto num_workers() const { return m_workers.size(); }
+
+        // shared pool used by the bvh builders and scene setup
+        static ThreadPool& global();
+
+        // the thread that waits on a task group also runs tasks, so one worker less than
+        // the core count keeps every core busy
+        static unsigned int default_num_workers() {
+            return std::max(std::thread::hardware_concurrency(), 2u) - 1;
+        }
+
+    private:
+        void worker_func();
+
+    private:
+        std::mutex                        m_queue_mtx;
+        std::condition_variable           m_queue_cv;
+        std::condition_variable           m_waiters_cv; // threads waiting on a task group
+        std::deque<std::function<void()>> m_queue;
+        bool                              m_stopping = false;
+
+        std::vector<std::thread> m_workers;
+    };
+
+    // fork/join on top of the pool. wait() keeps running queued tasks instead of blocking,
+    // so tasks can fork and wait on their own groups without starving the pool. with the
+    // queue empty it sleeps until a task is queued or the group is done
+    class TaskGroup final {
+    public:
+        TaskGroup(ThreadPool& pool = ThreadPool::global())
+            : m_pool(pool) {}
+
+        // never throws, an exception wait() was not called for is dropped
+        ~TaskGroup() { join(); }
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        template <typename Fn>
+        void run(Fn&& fn) {
+            m_pending.fetch_add(1, std::memory_order_relaxed);
+
+            m_pool.submit([this, fn = std::forward<Fn>(fn)]() mutable {
+                try {
+                    fn();
+                }
+                catch (...) {
+                    std::lock_guard lk(m_exception_mtx);
+
+                    if (!m_exception)
+                        m_exception = std::current_exception();
+                }
+
+                task_done();
+            });
+        }
+
+        // rethrows the first exception a task threw, once every task has finished
+        void wait() {
+            join();
+
+            std::exception_ptr exception;
+
+            {
+                std::lock_guard lk(m_exception_mtx);
+                std::swap(exception, m_exception);
+            }
+
+            if (exception)
+                std::rethrow_exception(exception);
+        }
+
+    private:
+        void join() {
+            while (m_pending.load(std::memory_order_acquire) != 0) {
+                if (m_pool.run_one())
+                    continue;
+
+                m_pool.wait_for_task(
+                    [this] { return m_pending.load(std::memory_order_acquire) == 0; });
+            }
+        }
+
+        // counted down under the queue lock, so no waiter misses it. the group may be gone
+        // right after, nothing of it is touched once the count is down
+        void task_done() {
+            m_pool.notify_waiters_if(
+                [this] { return m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1; });
+        }
+
+    private:
+        ThreadPool&         m_pool;
+        std::atomic<size_t> m_pending = 0;
+
+        std::mutex         m_exception_mtx;
+        std::exception_ptr m_exception;
+    };
+
+    // runs fn(first, last) over [begin, end) in chunks of grain items, chunk i always covers
+    // [begin + i * grain, begin + (i + 1) * grain) so callers can keep per chunk results
+    template <typename Fn>
+    void parallel_for(size_t begin, size_t end, size_t grain, Fn&& fn) {
+        grain = std::max<size_t>(grain, 1);
+
+        if (end <= begin + grain) {
+            if (end > begin)
+                fn(begin, end);
+
+            return;
+        }
+
+        TaskGroup tasks;
+
+        for (auto first = begin + grain; first < end; first += grain)
+            tasks.run([&fn, first, end, grain] { fn(first, std::min(first + grain, end)); });
+
+        fn(begin, begin + grain);
+
+        tasks.wait();
+    }
+
+} // namespace Oxy::Renderer